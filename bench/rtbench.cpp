@@ -0,0 +1,352 @@
+// Micro-benchmarks of the intersection kernels and of the BVH, without SDL.
+//
+//   rtbench [--scene name]... [--rays N] [--repeat R] [--seed S] [--bvh 8|16|pointers] [--json file]
+//
+// Every ray set comes from a fixed seed, so two builds measure the same rays :
+//   primary : camera rays through random points of the image
+//   diffuse : from the primary hits, in a cosine direction around the normal
+//   shadow  : from a point of a light to the primary hits, as direct_ray_color
+//   aimed   : from the camera to a jittered point of the box of a primitive, one ray per
+//             primitive, about half hit it (aabb, triangle and sphere kernels)
+//
+// Each measure runs repeat times on one thread, the best and the median are reported.
+// warm : after one untimed run, cold : the caches are flushed before every run.
+// The results are written as JSON (stdout, or --json file), the rest goes to stderr.
+// Run it from the build directory, like RTDemo : the scenes read ../data.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../include/ioutility.hpp"
+
+#ifndef RTBENCH_BUILD_TYPE
+#define RTBENCH_BUILD_TYPE ""
+#endif
+
+struct bench_ray {
+    ray r;
+    double t_min;
+    double t_max;
+};
+
+struct bench_result {
+    std::string scene;
+    std::string kernel;
+    std::string rays;       // ray set
+    std::string cache;      // warm or cold
+    size_t count;
+    size_t hits;
+    double best_ns;
+    double median_ns;
+};
+
+struct build_result {
+    std::string scene;
+    size_t primitives;
+    double best_ms;
+    double median_ms;
+};
+
+// Stream through a buffer larger than the last level cache.
+void flush_caches()
+{
+    static std::vector<unsigned char> buffer(size_t(64) << 20);
+    for(size_t i = 0; i < buffer.size(); i += 64)
+        buffer[i]++;
+}
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// kernel(i) : true if test i hits, count tests per run
+template <class F>
+bench_result measure(const std::string& scene, const std::string& kernel, const std::string& rays,
+    const bool cold, const size_t count, const int repeat, F test)
+{
+    bench_result result = {scene, kernel, rays, cold ? "cold" : "warm", count, 0, 0, 0};
+    std::vector<double> times;
+    if(!cold)
+        for(size_t i = 0; i < count; ++i)
+            test(i);
+    for(int r = 0; r < repeat; ++r){
+        if(cold)
+            flush_caches();
+        size_t hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < count; ++i)
+            hits += test(i) ? 1 : 0;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        times.push_back(seconds * 1e9 / std::max<size_t>(count, 1));
+        result.hits = hits;
+    }
+    result.best_ns = *std::min_element(times.begin(), times.end());
+    result.median_ns = median(times);
+    std::cerr << scene << " " << kernel << " " << rays << " " << result.cache << " : " << result.best_ns << " ns" << std::endl;
+    return result;
+}
+
+// Primitives of object, through the bvh and the lists, once each (lights are also in the world).
+void collect_primitives(const shared_ptr<hittable>& object, std::vector<shared_ptr<hittable>>& primitives,
+    std::set<const hittable *>& seen)
+{
+    if(const bvh_node *node = dynamic_cast<const bvh_node *>(object.get())){
+        collect_primitives(node->left, primitives, seen);
+        if(node->right != node->left)
+            collect_primitives(node->right, primitives, seen);
+    } else if(const hittable_list *list = dynamic_cast<const hittable_list *>(object.get())){
+        for(const auto& o : list->objects)
+            collect_primitives(o, primitives, seen);
+    } else if(const std::vector<shared_ptr<hittable>> *leaves = quantized_primitives(object.get())){
+        for(const auto& o : *leaves)
+            collect_primitives(o, primitives, seen);
+    } else if(seen.insert(object.get()).second){
+        primitives.push_back(object);
+    }
+}
+
+std::vector<bench_ray> primary_rays(const camera& cam, const size_t count, const unsigned int seed)
+{
+    seed_sampler(seed, 0, 0, 1);
+    std::vector<bench_ray> rays(count);
+    for(bench_ray& b : rays)
+        b = {cam.get_ray(random_double(), random_double()), 0.001, infinity};
+    return rays;
+}
+
+std::vector<bench_ray> diffuse_rays(hittable& world, const std::vector<bench_ray>& primary, const unsigned int seed)
+{
+    seed_sampler(seed, 0, 0, 2);
+    std::vector<bench_ray> rays;
+    for(const bench_ray& b : primary){
+        hit_record rec;
+        if(world.hit(b.r, b.t_min, b.t_max, rec))
+            rays.push_back({ray(rec.p, rec.normal + random_unit_vector()), 0.001, infinity});
+    }
+    return rays;
+}
+
+std::vector<bench_ray> shadow_rays(hittable& world, const std::vector<shared_ptr<hittable>>& lights,
+    const std::vector<bench_ray>& primary, const unsigned int seed)
+{
+    seed_sampler(seed, 0, 0, 3);
+    std::vector<bench_ray> rays;
+    if(lights.empty())
+        return rays;
+    for(const bench_ray& b : primary){
+        hit_record rec;
+        if(!world.hit(b.r, b.t_min, b.t_max, rec))
+            continue;
+        const hittable& light = *lights[std::min(lights.size() - 1, size_t(random_double() * lights.size()))];
+        float u = sqrt(random_double());
+        float v = (1.0f - u) * sqrt(random_double());
+        point3 light_point = light.point(u, v);
+        rays.push_back({ray(light_point, rec.p - light_point), 0.001, 0.999});
+    }
+    return rays;
+}
+
+// one ray from the camera to a jittered point of the box of each primitive, count rays
+std::vector<bench_ray> aimed_rays(const camera& cam, const std::vector<aabb>& boxes, const size_t count, const unsigned int seed)
+{
+    seed_sampler(seed, 0, 0, 4);
+    std::vector<bench_ray> rays(count);
+    for(size_t i = 0; i < count; ++i){
+        const aabb& box = boxes[i % boxes.size()];
+        point3 center = 0.5 * (box.min() + box.max());
+        vec3 half = 0.5 * (box.max() - box.min());
+        vec3 jitter = random_in_unit_sphere() * 1.5;
+        point3 target = center + vec3(half.x * jitter.x, half.y * jitter.y, half.z * jitter.z);
+        rays[i] = {ray(cam.lookfrom, target - cam.lookfrom), 0.001, infinity};
+    }
+    return rays;
+}
+
+void bench_scene(const std::string& name, const size_t count, const int repeat, const unsigned int seed,
+    std::vector<bench_result>& results, std::vector<build_result>& builds)
+{
+    scene sc;
+    if(!load_scene(name, sc, 4.0 / 3.0, 800))
+        return;
+
+    std::vector<shared_ptr<hittable>> primitives;
+    std::set<const hittable *> seen;
+    for(const auto& object : sc.world.objects)
+        collect_primitives(object, primitives, seen);
+    std::vector<shared_ptr<hittable>> lights = sc.lights;
+    if(lights.empty())
+        for(const auto& p : primitives)
+            if(p->have_material_light())
+                lights.push_back(p);
+
+    // rays
+    std::vector<bench_ray> primary = primary_rays(sc.cam, count, seed);
+    std::vector<bench_ray> diffuse = diffuse_rays(sc.world, primary, seed);
+    std::vector<bench_ray> shadow = shadow_rays(sc.world, lights, primary, seed);
+    const std::pair<const char *, const std::vector<bench_ray> *> sets[3] = {
+        {"primary", &primary}, {"diffuse", &diffuse}, {"shadow", &shadow}
+    };
+
+    // traversal of the whole scene
+    hittable& world = sc.world;
+    for(const auto& set : sets){
+        const std::vector<bench_ray>& rays = *set.second;
+        if(rays.empty())
+            continue;
+        for(int cold = 0; cold < 2; ++cold)
+            results.push_back(measure(name, "world", set.first, cold, rays.size(), repeat, [&](size_t i){
+                hit_record rec;
+                return world.hit(rays[i].r, rays[i].t_min, rays[i].t_max, rec);
+            }));
+    }
+
+    // kernels, on the primitives of the scene
+    std::vector<aabb> boxes;
+    std::vector<const hittable *> triangles, spheres;
+    std::vector<aabb> triangle_boxes, sphere_boxes;
+    for(const auto& p : primitives){
+        aabb box;
+        if(!p->bounding_box(0, 1, box))
+            continue;
+        boxes.push_back(box);
+        if(dynamic_cast<const triangle *>(p.get())){
+            triangles.push_back(p.get());
+            triangle_boxes.push_back(box);
+        } else if(dynamic_cast<const sphere *>(p.get())){
+            spheres.push_back(p.get());
+            sphere_boxes.push_back(box);
+        }
+    }
+    if(!boxes.empty()){
+        std::vector<bench_ray> rays = aimed_rays(sc.cam, boxes, count, seed);
+        for(int cold = 0; cold < 2; ++cold)
+            results.push_back(measure(name, "aabb", "aimed", cold, count, repeat, [&](size_t i){
+                return boxes[i % boxes.size()].hit(rays[i].r, rays[i].t_min, rays[i].t_max);
+            }));
+    }
+    const std::pair<const char *, std::pair<std::vector<const hittable *> *, std::vector<aabb> *>> kernels[2] = {
+        {"triangle", {&triangles, &triangle_boxes}}, {"sphere", {&spheres, &sphere_boxes}}
+    };
+    for(const auto& kernel : kernels){
+        const std::vector<const hittable *>& objects = *kernel.second.first;
+        if(objects.empty())
+            continue;
+        std::vector<bench_ray> rays = aimed_rays(sc.cam, *kernel.second.second, count, seed);
+        for(int cold = 0; cold < 2; ++cold)
+            results.push_back(measure(name, kernel.first, "aimed", cold, count, repeat, [&](size_t i){
+                hit_record rec;
+                return objects[i % objects.size()]->hit(rays[i].r, rays[i].t_min, rays[i].t_max, rec);
+            }));
+    }
+
+    // bvh build on the primitives, in an arena as at load, without the progress messages
+    std::vector<double> times;
+    for(int r = 0; r < repeat; ++r){
+        scene_arena arena;
+        arena_scope scope(arena);
+        std::cerr.setstate(std::ios::failbit);
+        auto start = std::chrono::steady_clock::now();
+        auto tree = scene_new<bvh_node>(primitives, 0, primitives.size(), 0, 1);
+        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3);
+        std::cerr.clear();
+    }
+    builds.push_back({name, primitives.size(), *std::min_element(times.begin(), times.end()), median(times)});
+    std::cerr << name << " bvh build : " << builds.back().best_ms << " ms" << std::endl;
+}
+
+bool write_results(FILE *out, const std::vector<bench_result>& results, const std::vector<build_result>& builds,
+    const size_t count, const int repeat, const unsigned int seed, const std::string& bvh_name,
+    const size_t random_calls, const double random_best, const double random_median)
+{
+    fprintf(out, "{\n  \"build_type\": \"%s\",\n  \"seed\": %u,\n  \"rays\": %zu,\n  \"repeat\": %d,\n  \"bvh\": \"%s\",\n",
+        RTBENCH_BUILD_TYPE, seed, count, repeat, bvh_name.c_str());
+    fprintf(out, "  \"random_double\": {\"calls\": %zu, \"ns_per_call\": %g, \"median_ns_per_call\": %g, \"calls_per_s\": %g},\n",
+        random_calls, random_best, random_median, 1e9 / random_best);
+    fprintf(out, "  \"builds\": [\n");
+    for(size_t i = 0; i < builds.size(); ++i){
+        const build_result& b = builds[i];
+        fprintf(out, "    {\"scene\": \"%s\", \"primitives\": %zu, \"ms\": %g, \"median_ms\": %g}%s\n",
+            b.scene.c_str(), b.primitives, b.best_ms, b.median_ms, i + 1 < builds.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); ++i){
+        const bench_result& r = results[i];
+        fprintf(out, "    {\"scene\": \"%s\", \"kernel\": \"%s\", \"rays\": \"%s\", \"cache\": \"%s\", \"count\": %zu, \"hits\": %zu, "
+            "\"ns_per_ray\": %g, \"median_ns_per_ray\": %g, \"rays_per_s\": %g}%s\n",
+            r.scene.c_str(), r.kernel.c_str(), r.rays.c_str(), r.cache.c_str(), r.count, r.hits,
+            r.best_ns, r.median_ns, 1e9 / r.best_ns, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return ferror(out) == 0;
+}
+
+int main( int argc, char **argv ) {
+
+    std::vector<std::string> scene_list;
+    size_t count = 100000;
+    int repeat = 5;
+    unsigned int seed = 1;
+    std::string bvh_name = "pointers";
+    std::string json_file;
+
+    for(int a = 1; a < argc; ++a){
+        std::string value = argv[a];
+        bool has_arg = a + 1 < argc;
+        if(value == "--scene" && has_arg){
+            scene_list.push_back(argv[++a]);
+        } else if(value == "--rays" && has_arg){
+            count = std::max(1, atoi(argv[++a]));
+        } else if(value == "--repeat" && has_arg){
+            repeat = std::max(1, atoi(argv[++a]));
+        } else if(value == "--seed" && has_arg){
+            seed = atoi(argv[++a]);
+        } else if(value == "--bvh" && has_arg){
+            bvh_name = argv[++a];
+        } else if(value == "--json" && has_arg){
+            json_file = argv[++a];
+        } else {
+            std::cerr << "unknown option " << value << std::endl;
+            return -1;
+        }
+    }
+    if(scene_list.empty())
+        scene_list = {"cornell_empty", "bigguy", "final"};
+    scene_bvh_layout() = bvh_name == "8" ? bvh_quantized8 : bvh_name == "16" ? bvh_quantized16 : bvh_pointers;
+
+    // random_double, the sum is printed so the calls are not optimized away
+    const size_t random_calls = 10000000;
+    std::vector<double> random_times;
+    double sum = 0;
+    for(int r = 0; r < repeat; ++r){
+        seed_sampler(seed, 0, 0);
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < random_calls; ++i)
+            sum += random_double();
+        random_times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / random_calls);
+    }
+    std::cerr << "random_double : " << *std::min_element(random_times.begin(), random_times.end()) << " ns (sum " << sum << ")" << std::endl;
+
+    std::vector<bench_result> results;
+    std::vector<build_result> builds;
+    for(const std::string& name : scene_list)
+        bench_scene(name, count, repeat, seed, results, builds);
+
+    FILE *out = json_file.empty() ? stdout : fopen(json_file.c_str(), "wt");
+    if(out == NULL)
+    {
+        std::cerr << "[error] writing " << json_file << std::endl;
+        return -1;
+    }
+    bool ok = write_results(out, results, builds, count, repeat, seed, bvh_name, random_calls,
+        *std::min_element(random_times.begin(), random_times.end()), median(random_times));
+    if(out != stdout)
+        ok = (fclose(out) == 0) && ok;
+    return ok ? 0 : -1;
+}
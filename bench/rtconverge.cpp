@@ -0,0 +1,264 @@
+// Equal time convergence : error of the image against a reference, for a set of time
+// budgets, without SDL.
+//
+//   rtconverge [--scene name]... [--budgets 1,2,4,8] [--width W] [--depth D] [--seed S]
+//              [--references dir] [--reference-spp N] [--json file]
+//
+// The reference of a scene is a checkpoint <dir>/<scene>_<width>x<height>_d<depth>_s<spp>.ckpt :
+// linear radiance, as saved by RTDemo --checkpoint, with reference-spp samples and another
+// seed than the measured renders. A missing one, or one of another scene, size, depth, seed
+// or sample count, is rendered first and kept for the next runs : delete it after a change
+// of the scene, not after a change of the integrator.
+//
+// For each budget the render starts over and draws passes as long as the next one fits,
+// like RTDemo --time, then the image is compared to the reference :
+//   rmse       : root mean square error of the radiance (r, g, b)
+//   relmse     : mean of (x - ref)^2 / (ref^2 + 0.01), the bright pixels do not dominate
+//   ssim       : structural similarity of the luminance of the 8 bits image, 7x7 windows
+//   efficiency : 1 / (relmse * seconds), higher is better, constant for an unbiased
+//                renderer that only gets more samples
+//
+// The table goes to stderr, the results to stdout as JSON (or --json file). Run it from
+// the build directory, like RTDemo : the scenes read ../data.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/ioutility.hpp"
+#include "../include/render.hpp"
+#include "../include/progressive.hpp"
+#include "../include/checkpoint.hpp"
+
+#ifndef RTBENCH_BUILD_TYPE
+#define RTBENCH_BUILD_TYPE ""
+#endif
+
+struct converge_result {
+    std::string scene;
+    double budget;
+    double seconds;
+    int samples;
+    double rmse;
+    double relmse;
+    double ssim;
+};
+
+// ssim of the 8 bits luminance (gamma 2, as write_image) in windows of 7x7 pixels, summed
+// area tables of x, y, x^2, y^2 and xy
+double ssim(const framebuffer& fb, const framebuffer& ref)
+{
+    const int w = fb.width, h = fb.height, r = 3;
+    if (w <= 2 * r || h <= 2 * r)
+        return 1;
+    const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+    auto display = [](const color& c) {
+        return luminance(color(sqrt(clamp(c.x, 0.0, 1.0)), sqrt(clamp(c.y, 0.0, 1.0)), sqrt(clamp(c.z, 0.0, 1.0))));
+    };
+
+    const int stride = w + 1;
+    std::vector<double> sums[5];
+    for (int s = 0; s < 5; ++s)
+        sums[s].assign(size_t(stride) * (h + 1), 0.0);
+    for (int j = 0; j < h; ++j) {
+        for (int i = 0; i < w; ++i) {
+            unsigned int k = offset(i, j, h, w);
+            double x = display(fb.average(k)), y = display(ref.average(k));
+            const double values[5] = { x, y, x * x, y * y, x * y };
+            size_t at = size_t(j + 1) * stride + i + 1;
+            for (int s = 0; s < 5; ++s)
+                sums[s][at] = values[s] + sums[s][at - 1] + sums[s][at - stride] - sums[s][at - stride - 1];
+        }
+    }
+
+    const double n = (2 * r + 1) * (2 * r + 1);
+    double total = 0;
+    #pragma omp parallel for reduction(+:total)
+    for (int j = r; j < h - r; ++j) {
+        for (int i = r; i < w - r; ++i) {
+            size_t a = size_t(j - r) * stride + (i - r), b = a + 2 * r + 1;
+            size_t c = a + size_t(2 * r + 1) * stride, d = c + 2 * r + 1;
+            double m[5];
+            for (int s = 0; s < 5; ++s)
+                m[s] = (sums[s][d] - sums[s][b] - sums[s][c] + sums[s][a]) / n;
+            double var_x = m[2] - m[0] * m[0], var_y = m[3] - m[1] * m[1], cov = m[4] - m[0] * m[1];
+            total += ((2 * m[0] * m[1] + c1) * (2 * cov + c2))
+                   / ((m[0] * m[0] + m[1] * m[1] + c1) * (var_x + var_y + c2));
+        }
+    }
+    return total / (double(w - 2 * r) * (h - 2 * r));
+}
+
+void compare_images(const framebuffer& fb, const framebuffer& ref, converge_result& result)
+{
+    double squared = 0, relative = 0;
+    #pragma omp parallel for reduction(+:squared, relative)
+    for (int k = 0; k < (int) fb.size(); ++k) {
+        color x = fb.average(k), y = ref.average(k);
+        for (int a = 0; a < 3; ++a) {
+            double d = x[a] - y[a];
+            squared += d * d;
+            relative += d * d / (y[a] * y[a] + 0.01);
+        }
+    }
+    result.rmse = sqrt(squared / (3.0 * fb.size()));
+    result.relmse = relative / (3.0 * fb.size());
+    result.ssim = ssim(fb, ref);
+}
+
+// the stored reference of the scene, rendered if missing or of another scene, size, depth,
+// seed or sample count
+bool reference_image(scene& sc, const std::string& name, const std::string& filename, const int width,
+    const int height, const int max_depth, const unsigned int seed, const int spp, framebuffer& ref)
+{
+    sampler_state state;
+    if (access(filename.c_str(), R_OK) == 0 && load_checkpoint(filename, ref, state)) {
+        if (ref.width == width && ref.height == height && state.seed == seed && state.passes == (unsigned int) spp
+            && state.max_depth == max_depth && state.scene == checkpoint_scene(name)) {
+            std::cerr << "reference " << filename << " : " << ref.min_samples() << " samples per pixel" << std::endl;
+            return true;
+        }
+        std::cerr << "[warning] reference " << filename << " is " << state.scene << " " << ref.width << "x" << ref.height
+                  << ", depth " << state.max_depth << ", seed " << state.seed << ", " << state.passes
+                  << " passes, rendered again" << std::endl;
+    }
+
+    ref = framebuffer(width, height);
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s < spp; ++s) {
+        if (100 * s / spp != 100 * (s - 1) / spp)
+            std::cerr << "\rreference " << filename << " : " << 100 * s / spp << " %" << std::flush;
+        render_pass(sc.cam, sc.world, sc.background, ref, max_depth, seed, s);
+    }
+    state = { seed, (unsigned int) spp, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+              max_depth, name };
+    std::cerr << "\rreference " << filename << " : " << spp << " samples per pixel in " << state.seconds << " s" << std::endl;
+    return save_checkpoint(filename, ref, state);
+}
+
+void converge_scene(const std::string& name, const std::vector<double>& budgets, const int width,
+    const int max_depth, const unsigned int seed, const std::string& directory, const int reference_spp,
+    std::vector<converge_result>& results)
+{
+    const double aspect_ratio = 4.0 / 3.0;
+    const int height = static_cast<int>(width / aspect_ratio);
+    scene sc;
+    if (!load_scene(name, sc, aspect_ratio, width))
+        return;
+
+    std::string file = name;
+    std::replace(file.begin(), file.end(), '/', '_');
+    std::stringstream filename;
+    filename << directory << "/" << file << "_" << width << "x" << height << "_d" << max_depth << "_s" << reference_spp << ".ckpt";
+    framebuffer ref;
+    if (!reference_image(sc, name, filename.str(), width, height, max_depth, seed + 1, reference_spp, ref))
+        return;
+
+    for (double budget : budgets) {
+        framebuffer fb(width, height);
+        progressive_control progress(budget, 0, 0);
+        for (unsigned int pass = 0; ; ++pass) {
+            render_pass(sc.cam, sc.world, sc.background, fb, max_depth, seed, pass);
+            progress.record(fb.min_samples(), 0);
+            if (progress.should_stop())
+                break;
+        }
+        converge_result result;
+        result.scene = name;
+        result.budget = budget;
+        result.seconds = progress.elapsed();
+        result.samples = fb.min_samples();
+        compare_images(fb, ref, result);
+        results.push_back(result);
+
+        char line[256];
+        snprintf(line, sizeof(line), "  %-14s %6gs %8.2fs %6d spp   rmse %-10.4g relmse %-10.4g ssim %-8.4f efficiency %g",
+            name.c_str(), budget, result.seconds, result.samples, result.rmse, result.relmse, result.ssim,
+            1.0 / (result.relmse * result.seconds));
+        std::cerr << line << std::endl;
+    }
+}
+
+bool write_results(FILE *out, const std::vector<converge_result>& results, const int width, const int height,
+    const int max_depth, const unsigned int seed, const int reference_spp)
+{
+    fprintf(out, "{\n  \"build_type\": \"%s\",\n  \"width\": %d,\n  \"height\": %d,\n  \"max_depth\": %d,\n  \"seed\": %u,\n  \"reference_spp\": %d,\n",
+        RTBENCH_BUILD_TYPE, width, height, max_depth, seed, reference_spp);
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const converge_result& r = results[i];
+        fprintf(out, "    {\"scene\": \"%s\", \"budget\": %g, \"seconds\": %g, \"samples\": %d, \"rmse\": %g, \"relmse\": %g, "
+            "\"ssim\": %g, \"efficiency\": %g}%s\n",
+            r.scene.c_str(), r.budget, r.seconds, r.samples, r.rmse, r.relmse, r.ssim,
+            1.0 / (r.relmse * r.seconds), i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return ferror(out) == 0;
+}
+
+int main( int argc, char **argv ) {
+
+    std::vector<std::string> scene_list;
+    std::vector<double> budgets;
+    int width = 400;
+    int max_depth = 50;
+    unsigned int seed = 1;
+    std::string directory = "references";
+    int reference_spp = 1024;
+    std::string json_file;
+
+    for(int a = 1; a < argc; ++a){
+        std::string value = argv[a];
+        bool has_arg = a + 1 < argc;
+        if(value == "--scene" && has_arg){
+            scene_list.push_back(argv[++a]);
+        } else if(value == "--budgets" && has_arg){
+            std::stringstream list(argv[++a]);
+            std::string budget;
+            while(std::getline(list, budget, ','))
+                if(atof(budget.c_str()) > 0)
+                    budgets.push_back(atof(budget.c_str()));
+        } else if(value == "--width" && has_arg){
+            width = std::max(8, atoi(argv[++a]));
+        } else if(value == "--depth" && has_arg){
+            max_depth = std::max(1, atoi(argv[++a]));
+        } else if(value == "--seed" && has_arg){
+            seed = atoi(argv[++a]);
+        } else if(value == "--references" && has_arg){
+            directory = argv[++a];
+        } else if(value == "--reference-spp" && has_arg){
+            reference_spp = std::max(1, atoi(argv[++a]));
+        } else if(value == "--json" && has_arg){
+            json_file = argv[++a];
+        } else {
+            std::cerr << "unknown option " << value << std::endl;
+            return -1;
+        }
+    }
+    if(scene_list.empty())
+        scene_list = scene_names();
+    if(budgets.empty())
+        budgets = {1, 2, 4, 8};
+    mkdir(directory.c_str(), 0755);
+
+    std::vector<converge_result> results;
+    for(const std::string& name : scene_list)
+        converge_scene(name, budgets, width, max_depth, seed, directory, reference_spp, results);
+
+    FILE *out = json_file.empty() ? stdout : fopen(json_file.c_str(), "wt");
+    if(out == NULL)
+    {
+        std::cerr << "[error] writing " << json_file << std::endl;
+        return -1;
+    }
+    bool ok = write_results(out, results, width, static_cast<int>(width / (4.0 / 3.0)), max_depth, seed, reference_spp);
+    if(out != stdout)
+        ok = (fclose(out) == 0) && ok;
+    return ok ? 0 : -1;
+}
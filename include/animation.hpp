@@ -0,0 +1,222 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <cstdio>
+#include <future>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "utility.hpp"
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "ioutility.hpp"
+#include "render.hpp"
+
+// Batch rendering of many viewpoints of one loaded scene.
+//
+// A camera path is a text file, one key per line :
+//   time  lookfrom.x lookfrom.y lookfrom.z  lookat.x lookat.y lookat.z  [vfov]
+// Keys are interpolated with a Catmull-Rom spline (or linearly) at fps frames per second,
+// or rendered as they are, one frame per key, to render a list of viewpoints.
+// The output of frame N (image files, or raw RGB frames on stdout for an encoder) is
+// written on a background thread while frame N+1 renders.
+
+struct camera_key {
+    double time;
+    point3 lookfrom;
+    point3 lookat;
+    double vfov;
+};
+
+enum path_interpolation { interpolate_none, interpolate_linear, interpolate_spline };
+
+struct animation_settings {
+    int image_width;
+    int image_height;
+    int samples_per_pixel;
+    int max_depth;
+    unsigned int seed;
+    double fps = 24;
+    path_interpolation interpolation = interpolate_spline;
+    bool raw_stdout = false;        // rgb24 frames on stdout instead of image files
+    int raw_output = -1;            // descriptor of the real stdout, see redirect_stdout()
+    std::string basename = "frame";
+};
+
+bool read_camera_path(const char *filename, const camera& cam, std::vector<camera_key>& keys)
+{
+    FILE *in = fopen(filename, "rt");
+    if(in == NULL)
+    {
+        std::cerr << "[error] loading camera path " << filename << std::endl;
+        return false;
+    }
+
+    char line_buffer[1024];
+    while(fgets(line_buffer, sizeof(line_buffer), in) != NULL)
+    {
+        char *line = line_buffer;
+        while(*line && isspace(*line))
+            line++;
+        if(line[0] == '#' || line[0] == 0)
+            continue;
+
+        camera_key key;
+        key.vfov = cam.vfov;
+        double fx, fy, fz, ax, ay, az;
+        int n = sscanf(line, "%lf %lf %lf %lf %lf %lf %lf %lf", &key.time, &fx, &fy, &fz, &ax, &ay, &az, &key.vfov);
+        if(n < 7)
+        {
+            std::cerr << "[error] camera path " << filename << " : " << line << std::endl;
+            fclose(in);
+            return false;
+        }
+        key.lookfrom = point3(fx, fy, fz);
+        key.lookat = point3(ax, ay, az);
+        keys.push_back(key);
+    }
+    fclose(in);
+    return !keys.empty();
+}
+
+// frames keys around the lookat point of cam, one turn.
+std::vector<camera_key> turntable(const camera& cam, const int frames)
+{
+    std::vector<camera_key> keys;
+    vec3 d = cam.lookfrom - cam.lookat;
+    double radius = sqrt(d.x * d.x + d.z * d.z);
+    double angle = atan2(d.x, d.z);
+    for(int f = 0; f < frames; ++f){
+        double a = angle + 2 * pi * f / frames;
+        camera_key key;
+        key.time = f;
+        key.lookfrom = cam.lookat + vec3(radius * sin(a), d.y, radius * cos(a));
+        key.lookat = cam.lookat;
+        key.vfov = cam.vfov;
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+inline vec3 catmull_rom(const vec3& p0, const vec3& p1, const vec3& p2, const vec3& p3, double t)
+{
+    double t2 = t * t;
+    double t3 = t2 * t;
+    return 0.5 * ((2 * p1) + (p2 - p0) * t + (2 * p0 - 5 * p1 + 4 * p2 - p3) * t2 + (3 * p1 - p0 - 3 * p2 + p3) * t3);
+}
+
+camera_key interpolate(const std::vector<camera_key>& keys, const double time, const path_interpolation mode)
+{
+    if(time <= keys.front().time) return keys.front();
+    if(time >= keys.back().time) return keys.back();
+
+    size_t i = 0;
+    while(keys[i + 1].time < time)
+        i++;
+    const camera_key& k1 = keys[i];
+    const camera_key& k2 = keys[i + 1];
+    const camera_key& k0 = keys[i > 0 ? i - 1 : i];
+    const camera_key& k3 = keys[i + 2 < keys.size() ? i + 2 : i + 1];
+    double t = (time - k1.time) / (k2.time - k1.time);
+
+    camera_key key;
+    key.time = time;
+    key.vfov = k1.vfov + (k2.vfov - k1.vfov) * t;
+    if(mode == interpolate_spline){
+        key.lookfrom = catmull_rom(k0.lookfrom, k1.lookfrom, k2.lookfrom, k3.lookfrom, t);
+        key.lookat = catmull_rom(k0.lookat, k1.lookat, k2.lookat, k3.lookat, t);
+    } else {
+        key.lookfrom = k1.lookfrom + t * (k2.lookfrom - k1.lookfrom);
+        key.lookat = k1.lookat + t * (k2.lookat - k1.lookat);
+    }
+    return key;
+}
+
+// Camera of every frame of the path.
+std::vector<camera_key> sample_path(const std::vector<camera_key>& keys, const animation_settings& settings)
+{
+    if(settings.interpolation == interpolate_none || keys.size() < 2)
+        return keys;
+    std::vector<camera_key> frames;
+    double duration = keys.back().time - keys.front().time;
+    int count = std::max(1, int(duration * settings.fps + 0.5) + 1);
+    for(int f = 0; f < count; ++f)
+        frames.push_back(interpolate(keys, keys.front().time + f / settings.fps, settings.interpolation));
+    return frames;
+}
+
+// Keep the real stdout for the raw frames and send everything else printed on stdout
+// (the loaders use printf) to stderr. Call before loading the scene.
+void redirect_stdout(animation_settings& settings)
+{
+    fflush(stdout);
+    settings.raw_output = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+}
+
+int render_animation(scene& sc, const std::vector<camera_key>& frames, const animation_settings& settings)
+{
+    const double aspect_ratio = double(settings.image_width) / settings.image_height;
+    const camera& base = sc.cam;
+
+    const int raw_output = settings.raw_output;
+    if(settings.raw_stdout && raw_output < 0)
+    {
+        std::cerr << "[error] raw frames need redirect_stdout()" << std::endl;
+        return -1;
+    }
+
+    std::future<bool> pending;
+    std::vector<unsigned char> rgb(settings.image_width * settings.image_height * 3);
+    framebuffer fb(settings.image_width, settings.image_height);
+    bool ok = true;
+
+    for(size_t f = 0; f < frames.size() && ok; ++f)
+    {
+        const camera_key& key = frames[f];
+        camera cam(key.lookfrom, key.lookat, base.vup, key.vfov, aspect_ratio, base.aperture,
+            (key.lookfrom - key.lookat).length());
+
+        fb.clear();
+        for(int s = 0; s < settings.samples_per_pixel; ++s)
+            render_pass(cam, sc.world, sc.background, fb, settings.max_depth, settings.seed, s, f);
+        std::cerr << "\rframe " << f + 1 << " / " << frames.size() << std::flush;
+
+        // one output in flight : wait for the previous frame before handing over this one
+        if(pending.valid())
+            ok = pending.get();
+
+        if(settings.raw_stdout){
+            tone_map(fb.pixel_list, fb.sample_list, fb.width, fb.height, rgb, true);
+            pending = std::async(std::launch::async, [raw_output, rgb]{
+                size_t size = rgb.size();
+                const unsigned char *p = rgb.data();
+                while(size > 0){
+                    ssize_t n = write(raw_output, p, size);
+                    if(n <= 0) return false;
+                    p += n;
+                    size -= n;
+                }
+                return true;
+            });
+        } else {
+            char name[1024];
+            snprintf(name, sizeof(name), "%s_%04d", settings.basename.c_str(), int(f));
+            std::string filename = name;
+            pending = std::async(std::launch::async, [fb, filename]{
+                write_image(fb, filename);
+                return true;
+            });
+        }
+    }
+    if(pending.valid())
+        ok = pending.get() && ok;
+    std::cerr << std::endl;
+
+    if(!ok)
+        std::cerr << "[error] writing frames" << std::endl;
+    return ok ? 0 : -1;
+}
+
+#endif
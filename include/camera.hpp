@@ -14,7 +14,9 @@ class camera {
             double aspect_ratio,
             double aperture,
             double focus_dist
-        ) {
+        ) : lookfrom(lookfrom), lookat(lookat), vup(vup), vfov(vfov),
+            aspect_ratio(aspect_ratio), aperture(aperture), focus_dist(focus_dist)
+        {
             auto theta = degrees_to_radians(vfov);
             auto h = tan(theta/2);
             auto viewport_height = 2.0 * h;
@@ -42,6 +44,25 @@ class camera {
             );
         }
 
+        // same ray, with the differentials of a step of ds in s and dt in t (one pixel)
+        ray get_ray(double s, double t, double ds, double dt) const {
+            vec3 rd = lens_radius * random_in_unit_disk();
+            vec3 offset = u * rd.x + v * rd.y;
+            vec3 direction = lower_left_corner + s*horizontal + t*vertical - origin - offset;
+
+            return ray(origin + offset, direction, direction + ds*horizontal, direction + dt*vertical);
+        }
+
+    public:
+        // parameters the camera was built with, to rebuild a moved camera
+        point3 lookfrom;
+        point3 lookat;
+        vec3 vup;
+        double vfov;
+        double aspect_ratio;
+        double aperture;
+        double focus_dist;
+
     private:
         point3 origin;
         point3 lower_left_corner;
@@ -0,0 +1,189 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "utility.hpp"
+#include "framebuffer.hpp"
+#include "trace.hpp"
+
+// Binary checkpoint of a render : the accumulation buffer stored in float, the sample
+// count of each pixel and the sampler state (seed and number of passes already drawn),
+// with the scene and the max depth it was rendered with : a resume or a merge of another
+// render is refused.
+//
+// layout (little endian) :
+//   header      : magic "RTCK", version, width, height, seed, passes, seconds, max_depth, scene
+//   radiance    : width*height*3 float
+//   luminance   : width*height float, sum of squared luminance
+//   samples     : width*height uint32
+
+struct checkpoint_header {
+    char magic[4];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    uint32_t seed;
+    uint32_t passes;    // passes drawn with this seed, the next pass uses this index
+    double seconds;     // render time accumulated so far
+    int32_t max_depth;
+    char scene[256];    // name given to --scene, truncated
+};
+
+const uint32_t checkpoint_version = 2;
+
+struct sampler_state {
+    unsigned int seed;
+    unsigned int passes;
+    double seconds;
+    int max_depth;
+    std::string scene;
+};
+
+// the scene name as stored in a checkpoint
+inline std::string checkpoint_scene(const std::string& scene) {
+    return scene.substr(0, sizeof(checkpoint_header::scene) - 1);
+}
+
+// false, with an error, if the checkpoint filename was not rendered with scene and max_depth
+bool same_render(const sampler_state& state, const std::string& scene, const int max_depth,
+    const std::string& filename)
+{
+    if(state.scene != checkpoint_scene(scene) || state.max_depth != max_depth)
+    {
+        std::cerr << "[error] " << filename << " is a checkpoint of " << state.scene << " (depth "
+                  << state.max_depth << "), not of " << scene << " (depth " << max_depth << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Write the checkpoint in a temporary file then rename it, so an interrupted
+// write never replaces a valid checkpoint.
+bool save_checkpoint(const std::string& filename, const framebuffer& fb, const sampler_state& state)
+{
+    RT_TRACE("save_checkpoint");
+    std::string tmp = filename + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if(out == NULL)
+    {
+        std::cerr << "[error] writing checkpoint " << tmp << std::endl;
+        return false;
+    }
+
+    checkpoint_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "RTCK", 4);
+    header.version = checkpoint_version;
+    header.width = fb.width;
+    header.height = fb.height;
+    header.seed = state.seed;
+    header.passes = state.passes;
+    header.seconds = state.seconds;
+    header.max_depth = state.max_depth;
+    strncpy(header.scene, state.scene.c_str(), sizeof(header.scene) - 1);
+
+    std::vector<float> radiance(fb.size()*3);
+    std::vector<float> lum(fb.size());
+    for(size_t k = 0; k < fb.size(); ++k){
+        radiance[k*3] = float(fb.pixel_list[k].x);
+        radiance[k*3+1] = float(fb.pixel_list[k].y);
+        radiance[k*3+2] = float(fb.pixel_list[k].z);
+        lum[k] = float(fb.luminance_list[k]);
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+        && fwrite(radiance.data(), sizeof(float), radiance.size(), out) == radiance.size()
+        && fwrite(lum.data(), sizeof(float), lum.size(), out) == lum.size()
+        && fwrite(fb.sample_list.data(), sizeof(unsigned int), fb.size(), out) == fb.size();
+    ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    fclose(out);
+
+    if(!ok || rename(tmp.c_str(), filename.c_str()) != 0)
+    {
+        std::cerr << "[error] writing checkpoint " << filename << std::endl;
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool load_checkpoint(const std::string& filename, framebuffer& fb, sampler_state& state)
+{
+    FILE *in = fopen(filename.c_str(), "rb");
+    if(in == NULL)
+    {
+        std::cerr << "[error] loading checkpoint " << filename << std::endl;
+        return false;
+    }
+
+    checkpoint_header header;
+    if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, "RTCK", 4) != 0
+        || header.version != checkpoint_version || header.width <= 0 || header.height <= 0)
+    {
+        std::cerr << "[error] " << filename << " is not a checkpoint" << std::endl;
+        fclose(in);
+        return false;
+    }
+
+    fb = framebuffer(header.width, header.height);
+    std::vector<float> radiance(fb.size()*3);
+    std::vector<float> lum(fb.size());
+    bool ok = fread(radiance.data(), sizeof(float), radiance.size(), in) == radiance.size()
+        && fread(lum.data(), sizeof(float), lum.size(), in) == lum.size()
+        && fread(fb.sample_list.data(), sizeof(unsigned int), fb.size(), in) == fb.size();
+    fclose(in);
+    if(!ok)
+    {
+        std::cerr << "[error] truncated checkpoint " << filename << std::endl;
+        return false;
+    }
+
+    for(size_t k = 0; k < fb.size(); ++k){
+        fb.pixel_list[k] = color(radiance[k*3], radiance[k*3+1], radiance[k*3+2]);
+        fb.luminance_list[k] = lum[k];
+    }
+    state.seed = header.seed;
+    state.passes = header.passes;
+    state.seconds = header.seconds;
+    state.max_depth = header.max_depth;
+    header.scene[sizeof(header.scene) - 1] = 0;
+    state.scene = header.scene;
+    return true;
+}
+
+// Add the samples of another render of the same frame. The merged state keeps the seed
+// of fb and skips the passes of both renders, so resuming never replays a sample.
+bool merge_checkpoint(framebuffer& fb, sampler_state& state, const framebuffer& other,
+    const sampler_state& other_state)
+{
+    if(fb.width != other.width || fb.height != other.height)
+    {
+        std::cerr << "[error] merging checkpoints of different size" << std::endl;
+        return false;
+    }
+    if(state.scene != other_state.scene || state.max_depth != other_state.max_depth)
+    {
+        std::cerr << "[error] merging checkpoints of " << state.scene << " (depth " << state.max_depth
+                  << ") and " << other_state.scene << " (depth " << other_state.max_depth << ")" << std::endl;
+        return false;
+    }
+    if(state.seed == other_state.seed)
+        std::cerr << "[warning] merging checkpoints rendered with the same seed" << std::endl;
+
+    for(size_t k = 0; k < fb.size(); ++k){
+        fb.pixel_list[k] += other.pixel_list[k];
+        fb.luminance_list[k] += other.luminance_list[k];
+        fb.sample_list[k] += other.sample_list[k];
+    }
+    state.passes += other_state.passes;
+    state.seconds += other_state.seconds;
+    return true;
+}
+
+#endif
@@ -0,0 +1,364 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "utility.hpp"
+#include "framebuffer.hpp"
+#include "ioutility.hpp"
+#include "render.hpp"
+
+// Distributed rendering over TCP.
+//
+// The coordinator listens on a port, splits the frame in tiles and sample ranges and
+// hands them to the workers that connect. A worker receives the job description once,
+// loads the scene, then renders the tiles it is given and streams back the float
+// buffers of each tile, which the coordinator adds to its framebuffer. When a worker
+// disconnects, its tile goes back in the queue for another worker.
+//
+// Messages are a message_header followed by size bytes, in the byte order of the
+// machines, which must be the same on every node.
+
+enum message_type : uint32_t {
+    msg_job = 1,        // coordinator -> worker : job_description
+    msg_tile = 2,       // coordinator -> worker : tile_job
+    msg_result = 3,     // worker -> coordinator : tile_job + radiance, luminance floats
+    msg_done = 4        // coordinator -> worker : no more tiles
+};
+
+struct message_header {
+    uint32_t type;
+    uint32_t size;
+};
+
+struct job_description {
+    char scene[64];
+    int32_t width;
+    int32_t height;
+    int32_t max_depth;
+    uint32_t seed;
+};
+
+struct tile_job {
+    uint32_t id;
+    int32_t x0, y0, x1, y1;
+    uint32_t first_pass;
+    uint32_t passes;
+};
+
+bool send_all(int fd, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while(size > 0){
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool recv_all(int fd, void *data, size_t size)
+{
+    char *p = static_cast<char *>(data);
+    while(size > 0){
+        ssize_t n = recv(fd, p, size, 0);
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool send_message(int fd, uint32_t type, const void *data, uint32_t size,
+    const void *extra = nullptr, uint32_t extra_size = 0)
+{
+    message_header header = {type, size + extra_size};
+    return send_all(fd, &header, sizeof(header))
+        && (size == 0 || send_all(fd, data, size))
+        && (extra_size == 0 || send_all(fd, extra, extra_size));
+}
+
+// false on a payload above max_size : the size comes from the peer, checked before allocating
+bool recv_message(int fd, message_header& header, std::vector<char>& payload, const uint32_t max_size)
+{
+    if(!recv_all(fd, &header, sizeof(header)))
+        return false;
+    if(header.size > max_size)
+    {
+        std::cerr << "[error] message of " << header.size << " bytes, at most " << max_size << " expected" << std::endl;
+        return false;
+    }
+    payload.resize(header.size);
+    return header.size == 0 || recv_all(fd, payload.data(), header.size);
+}
+
+// Float payload of a rendered tile : radiance sums (3 per pixel) then squared luminance sums.
+size_t tile_floats(const tile_job& job)
+{
+    return size_t(job.x1 - job.x0) * (job.y1 - job.y0) * 4;
+}
+
+struct coordinator_settings {
+    int port = 7777;
+    int tile_size = 64;
+    int tile_passes = 16;           // samples per pixel of one work item
+    double worker_timeout = 600;    // seconds without an answer before a worker is dropped
+};
+
+class coordinator {
+    public:
+        coordinator(const job_description& job, int spp, const coordinator_settings& settings)
+            : job(job), settings(settings), fb(job.width, job.height), total(0), completed(0),
+              finished(false), worker_count(0)
+        {
+            // tiles first, then sample ranges, so the whole image converges together
+            for(int first = 0; first < spp; first += settings.tile_passes){
+                for(int y = 0; y < job.height; y += settings.tile_size){
+                    for(int x = 0; x < job.width; x += settings.tile_size){
+                        tile_job t;
+                        t.id = total++;
+                        t.x0 = x;
+                        t.y0 = y;
+                        t.x1 = std::min(job.width, x + settings.tile_size);
+                        t.y1 = std::min(job.height, y + settings.tile_size);
+                        t.first_pass = first;
+                        t.passes = std::min(settings.tile_passes, spp - first);
+                        queue.push_back(t);
+                    }
+                }
+            }
+        }
+
+        // Accept workers until every tile is back, false if the port can not be opened.
+        bool run() {
+            int server = socket(AF_INET, SOCK_STREAM, 0);
+            int yes = 1;
+            setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_ANY);
+            address.sin_port = htons(settings.port);
+            if(server < 0 || bind(server, (sockaddr *) &address, sizeof(address)) < 0 || listen(server, 64) < 0)
+            {
+                std::cerr << "[error] coordinator can not listen on port " << settings.port << std::endl;
+                if(server >= 0) close(server);
+                return false;
+            }
+            std::cerr << "coordinator listening on port " << settings.port << ", " << total << " tiles" << std::endl;
+
+            std::vector<std::thread> workers;
+            while(!finished)
+            {
+                pollfd p = {server, POLLIN, 0};
+                if(poll(&p, 1, 200) > 0 && (p.revents & POLLIN)){
+                    int fd = accept(server, nullptr, nullptr);
+                    if(fd >= 0)
+                        workers.emplace_back(&coordinator::serve, this, fd);
+                }
+                std::cerr << "\rtiles : " << completed << " / " << total << std::flush;
+            }
+            std::cerr << std::endl;
+            close(server);
+            for(std::thread& t : workers)
+                t.join();
+            return true;
+        }
+
+    private:
+        // One thread per connected worker.
+        void serve(int fd) {
+            int yes = 1;
+            setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            timeval timeout = {(time_t) settings.worker_timeout, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            int id = ++worker_count;
+            std::cerr << "\nworker " << id << " connected" << std::endl;
+            bool alive = send_message(fd, msg_job, &job, sizeof(job));
+
+            message_header header;
+            std::vector<char> payload;
+            while(alive)
+            {
+                tile_job t;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [this]{ return finished || !queue.empty(); });
+                    if(finished)
+                        break;
+                    t = queue.front();
+                    queue.pop_front();
+                }
+
+                const uint32_t result_size = sizeof(tile_job) + tile_floats(t) * sizeof(float);
+                alive = send_message(fd, msg_tile, &t, sizeof(t))
+                    && recv_message(fd, header, payload, result_size)
+                    && header.type == msg_result
+                    && header.size == result_size
+                    && same_tile(t, payload.data());
+
+                std::unique_lock<std::mutex> guard(lock);
+                if(!alive){
+                    // the worker is gone, somebody else renders its tile
+                    std::cerr << "\nworker " << id << " lost, tile " << t.id << " reassigned" << std::endl;
+                    queue.push_front(t);
+                } else {
+                    merge(t, reinterpret_cast<const float *>(payload.data() + sizeof(tile_job)));
+                    if(++completed == total)
+                        finished = true;
+                }
+                guard.unlock();
+                changed.notify_all();
+            }
+
+            if(alive)
+                send_message(fd, msg_done, nullptr, 0);
+            close(fd);
+        }
+
+        // the result is for the tile that was sent, not a stale or forged one
+        static bool same_tile(const tile_job& t, const char *data) {
+            tile_job answer;
+            memcpy(&answer, data, sizeof(answer));
+            return answer.id == t.id && answer.x0 == t.x0 && answer.y0 == t.y0 && answer.x1 == t.x1
+                && answer.y1 == t.y1 && answer.first_pass == t.first_pass && answer.passes == t.passes;
+        }
+
+        void merge(const tile_job& t, const float *data) {
+            int w = t.x1 - t.x0;
+            int h = t.y1 - t.y0;
+            const float *lum = data + w * h * 3;
+            for(int j = 0; j < h; ++j){
+                for(int i = 0; i < w; ++i){
+                    int k = i + j * w;
+                    unsigned int p = offset(t.x0 + i, t.y0 + j, fb.height, fb.width);
+                    fb.pixel_list[p] += color(data[k*3], data[k*3+1], data[k*3+2]);
+                    fb.luminance_list[p] += lum[k];
+                    fb.sample_list[p] += t.passes;
+                }
+            }
+        }
+
+    public:
+        job_description job;
+        coordinator_settings settings;
+        framebuffer fb;
+
+    private:
+        std::mutex lock;
+        std::condition_variable changed;
+        std::deque<tile_job> queue;
+        unsigned int total;
+        unsigned int completed;
+        std::atomic<bool> finished;
+        std::atomic<int> worker_count;
+};
+
+int connect_to(const std::string& host, int port)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = nullptr;
+    if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+        return -1;
+
+    int fd = -1;
+    for(addrinfo *a = addresses; a != nullptr && fd < 0; a = a->ai_next){
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) < 0){
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+// Worker : connect to host:port, load the scene once, render tiles until the coordinator
+// has no more work.
+int run_worker(const std::string& host, int port)
+{
+    int fd = -1;
+    // the coordinator may not be listening yet
+    for(int attempt = 0; attempt < 50 && fd < 0; ++attempt){
+        fd = connect_to(host, port);
+        if(fd < 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    if(fd < 0)
+    {
+        std::cerr << "[error] worker can not connect to " << host << ":" << port << std::endl;
+        return -1;
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    message_header header;
+    std::vector<char> payload;
+    if(!recv_message(fd, header, payload, sizeof(job_description)) || header.type != msg_job || header.size != sizeof(job_description))
+    {
+        std::cerr << "[error] worker did not receive a job" << std::endl;
+        close(fd);
+        return -1;
+    }
+    job_description job;
+    memcpy(&job, payload.data(), sizeof(job));
+    job.scene[sizeof(job.scene) - 1] = 0;
+
+    scene sc;
+    if(!load_scene(job.scene, sc, double(job.width) / job.height, job.width))
+    {
+        close(fd);
+        return -1;
+    }
+
+    int tiles = 0;
+    std::vector<float> data;
+    while(recv_message(fd, header, payload, sizeof(tile_job)) && header.type == msg_tile && header.size == sizeof(tile_job))
+    {
+        tile_job t;
+        memcpy(&t, payload.data(), sizeof(t));
+
+        framebuffer tile(t.x1 - t.x0, t.y1 - t.y0);
+        render_tile(sc.cam, sc.world, sc.background, tile, job.width, job.height, t.x0, t.y0,
+            job.max_depth, job.seed, t.first_pass, t.passes, t.id);
+
+        data.resize(tile_floats(t));
+        float *lum = data.data() + tile.size() * 3;
+        for(size_t k = 0; k < tile.size(); ++k){
+            data[k*3] = float(tile.pixel_list[k].x);
+            data[k*3+1] = float(tile.pixel_list[k].y);
+            data[k*3+2] = float(tile.pixel_list[k].z);
+            lum[k] = float(tile.luminance_list[k]);
+        }
+        if(!send_message(fd, msg_result, &t, sizeof(t), data.data(), data.size() * sizeof(float)))
+            break;
+        std::cerr << "\rtiles rendered : " << ++tiles << std::flush;
+    }
+    std::cerr << std::endl;
+    close(fd);
+    return 0;
+}
+
+#endif
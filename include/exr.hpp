@@ -0,0 +1,205 @@
+#ifndef EXR_H
+#define EXR_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Minimal OpenEXR writer : single part scanline image, no compression, channels B, G, R
+// in half or float. Without compression every scanline block has the same size, so the
+// offset table is written first and the lines can be streamed in order, a band at a
+// time (see write_lines).
+//
+// layout (little endian) :
+//   magic 76 2f 31 01, version 2
+//   header      : attributes "name\0type\0" int32 size, value, ended by a 0 byte
+//   offsets     : height uint64, file offset of each scanline block
+//   scanlines   : int32 y, int32 size, then the B values of the line, the G, the R
+
+enum exr_pixel_type { exr_half = 1, exr_float = 2 };
+
+// float to IEEE half, round to nearest even
+inline uint16_t float_to_half(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    uint32_t sign = (f >> 16) & 0x8000;
+    int32_t biased = (f >> 23) & 0xff;
+    uint32_t mantissa = f & 0x7fffff;
+
+    if(biased == 0xff)                  // inf, nan
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    int32_t exponent = biased - 127 + 15;
+    if(exponent >= 31)                  // too large, inf
+        return sign | 0x7c00;
+    if(exponent <= 0){                  // half subnormal or 0
+        if(exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+    uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;                         // a carry into the exponent is still correct
+    return sign | half;
+}
+
+class exr_writer {
+    public:
+        exr_writer() : out(NULL), width(0), height(0), type(exr_half), next_line(0) {}
+        ~exr_writer() { close(); }
+
+        bool open(const std::string& filename, int w, int h, exr_pixel_type pixel_type = exr_half) {
+            close();
+            width = w;
+            height = h;
+            type = pixel_type;
+            next_line = 0;
+            out = fopen(filename.c_str(), "wb");
+            if(out == NULL)
+            {
+                std::cerr << "[error] writing " << filename << std::endl;
+                return false;
+            }
+
+            std::vector<unsigned char> header;
+            const unsigned char magic[8] = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+            header.insert(header.end(), magic, magic + 8);
+
+            std::vector<unsigned char> channels;
+            for(const char *name : {"B", "G", "R"}){
+                put_string(channels, name);
+                put_int(channels, type);
+                put_int(channels, 0);           // pLinear, reserved
+                put_int(channels, 1);           // x sampling
+                put_int(channels, 1);           // y sampling
+            }
+            channels.push_back(0);
+            attribute(header, "channels", "chlist", channels);
+
+            attribute(header, "compression", "compression", std::vector<unsigned char>(1, 0));
+            std::vector<unsigned char> window;
+            put_int(window, 0);
+            put_int(window, 0);
+            put_int(window, width - 1);
+            put_int(window, height - 1);
+            attribute(header, "dataWindow", "box2i", window);
+            attribute(header, "displayWindow", "box2i", window);
+            attribute(header, "lineOrder", "lineOrder", std::vector<unsigned char>(1, 0));
+            std::vector<unsigned char> value;
+            put_float(value, 1.0f);
+            attribute(header, "pixelAspectRatio", "float", value);
+            value.clear();
+            put_float(value, 0.0f);
+            put_float(value, 0.0f);
+            attribute(header, "screenWindowCenter", "v2f", value);
+            value.clear();
+            put_float(value, 1.0f);
+            attribute(header, "screenWindowWidth", "float", value);
+            header.push_back(0);
+
+            // offset table, every block has the same size
+            uint64_t block = line_block_size();
+            uint64_t first = header.size() + uint64_t(height) * 8;
+            for(int y = 0; y < height; ++y){
+                uint64_t offset = first + y * block;
+                for(int b = 0; b < 8; ++b)
+                    header.push_back((offset >> (8 * b)) & 0xff);
+            }
+            return fwrite(header.data(), 1, header.size(), out) == header.size();
+        }
+
+        // count lines starting at line y (0 : top of the image), rgb floats, 3 per pixel.
+        // Lines must be written in order.
+        bool write_lines(int y, int count, const float *rgb) {
+            if(out == NULL || y != next_line || y + count > height)
+                return false;
+            int bytes = type == exr_half ? 2 : 4;
+            std::vector<unsigned char> block;
+            block.reserve(line_block_size());
+            for(int l = 0; l < count; ++l){
+                block.clear();
+                put_int(block, y + l);
+                put_int(block, width * 3 * bytes);
+                for(int c = 2; c >= 0; --c){        // B, G, R
+                    const float *line = rgb + size_t(l) * width * 3;
+                    for(int i = 0; i < width; ++i){
+                        if(type == exr_half){
+                            uint16_t h = float_to_half(line[i*3 + c]);
+                            block.push_back(h & 0xff);
+                            block.push_back(h >> 8);
+                        } else
+                            put_float(block, line[i*3 + c]);
+                    }
+                }
+                if(fwrite(block.data(), 1, block.size(), out) != block.size())
+                    return false;
+            }
+            next_line += count;
+            return true;
+        }
+
+        // false if the lines were not all written
+        bool close() {
+            if(out == NULL)
+                return true;
+            bool complete = next_line == height;
+            complete = (fclose(out) == 0) && complete;
+            out = NULL;
+            return complete;
+        }
+
+    private:
+        uint64_t line_block_size() const {
+            return 8 + uint64_t(width) * 3 * (type == exr_half ? 2 : 4);
+        }
+
+        static void put_int(std::vector<unsigned char>& v, int32_t i) {
+            for(int b = 0; b < 4; ++b)
+                v.push_back((uint32_t(i) >> (8 * b)) & 0xff);
+        }
+
+        static void put_float(std::vector<unsigned char>& v, float f) {
+            int32_t i;
+            memcpy(&i, &f, sizeof(i));
+            put_int(v, i);
+        }
+
+        static void put_string(std::vector<unsigned char>& v, const char *s) {
+            v.insert(v.end(), s, s + strlen(s) + 1);
+        }
+
+        static void attribute(std::vector<unsigned char>& header, const char *name, const char *type_name,
+            const std::vector<unsigned char>& value) {
+            put_string(header, name);
+            put_string(header, type_name);
+            put_int(header, value.size());
+            header.insert(header.end(), value.begin(), value.end());
+        }
+
+    private:
+        FILE *out;
+        int width, height;
+        exr_pixel_type type;
+        int next_line;
+};
+
+bool write_exr(const std::string& filename, int width, int height, const float *rgb, exr_pixel_type type = exr_half)
+{
+    exr_writer writer;
+    return writer.open(filename, width, height, type)
+        && writer.write_lines(0, height, rgb)
+        && writer.close();
+}
+
+#endif
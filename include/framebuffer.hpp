@@ -0,0 +1,75 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <vector>
+
+#include "utility.hpp"
+
+inline double luminance(const color& c) {
+    return 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
+}
+
+// Accumulation buffer of the render : radiance sum, squared luminance sum (for the
+// noise estimate) and sample count of each pixel, indexed with offset().
+class framebuffer {
+    public:
+        framebuffer() : width(0), height(0) {}
+        framebuffer(int w, int h) : width(w), height(h) {
+            clear();
+        }
+
+        void clear() {
+            pixel_list.assign(width*height, color(0,0,0));
+            luminance_list.assign(width*height, 0.0);
+            sample_list.assign(width*height, 0);
+        }
+
+        void add(int i, int j, const color& c) {
+            unsigned int k = offset(i, j, height, width);
+            pixel_list[k] += c;
+            double l = luminance(c);
+            luminance_list[k] += l*l;
+            sample_list[k]++;
+        }
+
+        // average color of the pixel, before gamma
+        color average(unsigned int k) const {
+            return sample_list[k] > 0 ? pixel_list[k] / sample_list[k] : color(0,0,0);
+        }
+
+        unsigned int min_samples() const {
+            if (sample_list.empty()) return 0;
+            return *std::min_element(sample_list.begin(), sample_list.end());
+        }
+
+        size_t size() const { return pixel_list.size(); }
+
+    public:
+        int width, height;
+        std::vector<color> pixel_list;
+        std::vector<double> luminance_list;
+        std::vector<unsigned int> sample_list;
+};
+
+// Same conversion as write_image : average, gamma 2, top row first, 3 bytes per pixel.
+// Pixels without samples keep the previous content of rgb.
+void tone_map(const std::vector<color>& pixels, const std::vector<unsigned int>& samples,
+    const int width, const int height, std::vector<unsigned char>& rgb, const bool parallel = false)
+{
+    #pragma omp parallel for if(parallel)
+    for (int j = height-1; j >= 0; --j) {
+        for (int i = 0; i < width; ++i) {
+            unsigned int k = offset(i, j, height, width);
+            if (samples[k] == 0)
+                continue;
+            double scale = 1.0 / samples[k];
+            unsigned char *p = &rgb[(i + (height-j-1) * width) * 3];
+            p[0] = static_cast<unsigned char>(256 * clamp(sqrt(scale * pixels[k].x), 0.0, 0.999));
+            p[1] = static_cast<unsigned char>(256 * clamp(sqrt(scale * pixels[k].y), 0.0, 0.999));
+            p[2] = static_cast<unsigned char>(256 * clamp(sqrt(scale * pixels[k].z), 0.0, 0.999));
+        }
+    }
+}
+
+#endif
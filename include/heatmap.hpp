@@ -0,0 +1,148 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "utility.hpp"
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include "struct/hittable.hpp"
+
+// Debug renders of the cost of the camera rays, one ray through the center of each pixel
+// traced with a traversal_probe (stats.hpp, built with -DRT_HEATMAPS) :
+//
+//   nodes : bvh nodes visited
+//   prims : primitive tests
+//   time  : time of the traversal, in ns
+//   depth : number of bvh nodes above the closest hit (black without hit)
+//
+// Values are mapped on a blue - cyan - green - yellow - red ramp from 0 to the scale of
+// the mode, white above it. Without a scale, the 99th percentile of the image is used
+// (the maximum for the depth) and printed, to render another view or build at the same
+// scale. Each map is written with write_image as <basename>_<mode>.
+//
+//   --heatmap nodes:200,prims,time:5000
+
+enum heatmap_mode { heatmap_nodes, heatmap_prims, heatmap_time, heatmap_depth, heatmap_modes };
+
+const char *heatmap_names[heatmap_modes] = {"nodes", "prims", "time", "depth"};
+
+struct heatmap_settings {
+    unsigned int modes = 0;                 // bit of each heatmap_mode
+    double scale[heatmap_modes] = {};       // 0 : from the image
+};
+
+// "nodes:200,time" -> modes and scales, false if a name is unknown or without RT_HEATMAPS
+bool parse_heatmaps(const std::string& list, heatmap_settings& settings)
+{
+#ifndef RT_HEATMAPS
+    std::cerr << "[error] --heatmap needs a build with -DRT_HEATMAPS (cmake -DRT_HEATMAPS=ON)" << std::endl;
+    return false;
+#endif
+    std::stringstream names(list);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        double scale = 0;
+        size_t colon = name.find(':');
+        if (colon != std::string::npos) {
+            scale = atof(name.c_str() + colon + 1);
+            name = name.substr(0, colon);
+        }
+        int m = 0;
+        while (m < heatmap_modes && name != heatmap_names[m])
+            m++;
+        if (m == heatmap_modes) {
+            std::cerr << "[error] unknown heatmap " << name << " (nodes, prims, time, depth)" << std::endl;
+            return false;
+        }
+        settings.modes |= 1u << m;
+        settings.scale[m] = scale;
+    }
+    return true;
+}
+
+color heat_color(double x)
+{
+    if (x > 1)
+        return color(1, 1, 1);
+    const color ramp[5] = { color(0, 0, 1), color(0, 1, 1), color(0, 1, 0), color(1, 1, 0), color(1, 0, 0) };
+    double f = std::max(0.0, x) * 4;
+    int k = std::min(3, static_cast<int>(f));
+    f -= k;
+    return ramp[k] * (1 - f) + ramp[k+1] * f;
+}
+
+void render_heatmaps(const camera& cam, hittable& world, const int image_width, const int image_height,
+    const heatmap_settings& settings, const std::string& basename = "result")
+{
+    const size_t count = size_t(image_width) * image_height;
+    std::vector<double> values[heatmap_modes];
+    for (int m = 0; m < heatmap_modes; ++m)
+        if (settings.modes & (1u << m))
+            values[m].assign(count, 0.0);
+
+    #pragma omp parallel
+    {
+        seed_sampler(0, 0, thread_id(), 0);
+        #pragma omp for schedule(dynamic, 4)
+        for (int j = image_height-1; j >= 0; --j) {
+            for (int i = 0; i < image_width; ++i) {
+                ray r = cam.get_ray((i + 0.5) / (image_width-1), (j + 0.5) / (image_height-1));
+                hit_record rec;
+                traversal_probe probe;
+                set_active_probe(&probe);
+                auto start = std::chrono::steady_clock::now();
+                world.hit(r, 0.001, infinity, rec);
+                auto end = std::chrono::steady_clock::now();
+                set_active_probe(nullptr);
+
+                unsigned int k = offset(i, j, image_height, image_width);
+                if (!values[heatmap_nodes].empty()) values[heatmap_nodes][k] = probe.nodes;
+                if (!values[heatmap_prims].empty()) values[heatmap_prims][k] = probe.tests;
+                if (!values[heatmap_time].empty())
+                    values[heatmap_time][k] = std::chrono::duration<double, std::nano>(end - start).count();
+                if (!values[heatmap_depth].empty()) values[heatmap_depth][k] = probe.hit_depth;
+            }
+        }
+    }
+
+    for (int m = 0; m < heatmap_modes; ++m) {
+        if (values[m].empty())
+            continue;
+        // misses (depth -1) are left out
+        std::vector<double> v;
+        double sum = 0;
+        for (double x : values[m])
+            if (x >= 0) { v.push_back(x); sum += x; }
+        double scale = settings.scale[m], top = 0;
+        if (!v.empty()) {
+            size_t p = m == heatmap_depth ? v.size() - 1 : (v.size() - 1) * 99 / 100;
+            std::nth_element(v.begin(), v.begin() + p, v.end());
+            if (scale <= 0)
+                scale = v[p];
+            top = *std::max_element(v.begin(), v.end());
+        }
+        scale = std::max(scale, 1e-9);
+
+        // squared : write_image takes the square root (gamma 2)
+        framebuffer fb(image_width, image_height);
+        for (size_t k = 0; k < count; ++k) {
+            color c = values[m][k] < 0 ? color(0, 0, 0) : heat_color(values[m][k] / scale);
+            fb.pixel_list[k] = c * c;
+            fb.sample_list[k] = 1;
+        }
+        std::string name = basename + "_" + heatmap_names[m];
+        std::cerr << "heatmap " << heatmap_names[m] << " : scale " << scale << ", mean "
+                  << (v.empty() ? 0 : sum / v.size()) << ", max " << top << " -> " << name << std::endl;
+        write_image(fb, name);
+    }
+}
+
+#endif
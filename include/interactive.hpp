@@ -0,0 +1,245 @@
+#ifndef INTERACTIVE_H
+#define INTERACTIVE_H
+
+#include <chrono>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "utility.hpp"
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "preview.hpp"
+#include "render.hpp"
+
+// Interactive mode : the scene stays loaded, the camera is moved with the keyboard and
+// the mouse, and the image is refined while the camera does not move.
+//
+//   left drag        orbit around lookat
+//   right drag       pan
+//   wheel            dolly
+//   w a s d q e      move forward, left, back, right, down, up (shift : faster)
+//   r                back to the initial camera
+//   p                print the camera, to paste in an open_xxx function
+//   escape           quit
+//
+// While the camera moves, frames are rendered at 1/moving_scale resolution with
+// moving_depth bounces. Once idle for idle_delay, the accumulation restarts at full
+// resolution and full depth, rendered by bands of rows to keep the window responsive.
+
+struct interactive_settings {
+    int moving_scale = 4;
+    int moving_depth = 4;
+    double idle_delay = 0.2;    // seconds without input before refining
+    double frame_budget = 0.033; // seconds of rendering between two event polls
+};
+
+class orbit_controller {
+    public:
+        orbit_controller(const camera& cam) : initial(cam) {
+            reset();
+        }
+
+        void reset() {
+            lookat = initial.lookat;
+            vec3 d = initial.lookfrom - initial.lookat;
+            distance = d.length();
+            yaw = atan2(d.x, d.z);
+            pitch = asin(clamp(d.y / distance, -1.0, 1.0));
+        }
+
+        point3 lookfrom() const {
+            vec3 d(cos(pitch) * sin(yaw), sin(pitch), cos(pitch) * cos(yaw));
+            return lookat + distance * d;
+        }
+
+        void orbit(double dyaw, double dpitch) {
+            yaw += dyaw;
+            pitch = clamp(pitch + dpitch, -0.49 * pi, 0.49 * pi);
+        }
+
+        // move lookat in the camera frame (right, up, forward)
+        void move(double right, double up, double forward) {
+            vec3 f = unit_vector(lookat - lookfrom());
+            vec3 r = unit_vector(cross(f, initial.vup));
+            vec3 u = cross(r, f);
+            lookat += distance * (right * r + up * u + forward * f);
+        }
+
+        void dolly(double factor) {
+            distance = std::max(1e-3, distance * factor);
+        }
+
+        camera make_camera(double aspect_ratio) const {
+            point3 from = lookfrom();
+            return camera(from, lookat, initial.vup, initial.vfov, aspect_ratio,
+                initial.aperture, (from - lookat).length());
+        }
+
+    public:
+        camera initial;
+        point3 lookat;
+        double distance;
+        double yaw, pitch;
+};
+
+int run_interactive(hittable& world, color& background, const camera& cam,
+    const int image_width, const int image_height, const int max_depth,
+    const interactive_settings& settings = interactive_settings())
+{
+    if(SDL_Init(SDL_INIT_VIDEO) < 0)
+    {
+        std::cerr << "Failed to initialize the SDL2 library\n";
+        return -1;
+    }
+    SDL_Window *window = SDL_CreateWindow("render", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        image_width, image_height, 0);
+    SDL_Renderer *renderer = window ? SDL_CreateRenderer(window, -1, 0) : nullptr;
+    SDL_Texture *texture = renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24,
+        SDL_TEXTUREACCESS_STREAMING, image_width, image_height) : nullptr;
+    if(!texture)
+    {
+        std::cerr << "Failed to create window : " << SDL_GetError() << std::endl;
+        SDL_Quit();
+        return -1;
+    }
+
+    typedef std::chrono::steady_clock clock;
+    const double aspect_ratio = double(image_width) / image_height;
+    const int scale = std::max(1, settings.moving_scale);
+
+    orbit_controller controller(cam);
+    camera view = controller.make_camera(aspect_ratio);
+
+    framebuffer fb(image_width, image_height);
+    framebuffer low(std::max(1, image_width / scale), std::max(1, image_height / scale));
+    std::vector<unsigned char> rgb(image_width * image_height * 3, 0);
+    std::vector<unsigned char> low_rgb(low.width * low.height * 3, 0);
+
+    unsigned int frame = 0;         // seeds the sampler, never reused
+    int next_row = 0;               // next band of the full resolution pass
+    bool refining = false;
+    auto last_change = clock::now();
+    auto last_report = clock::now();
+    int frames_since_report = 0;
+
+    bool quit = false;
+    while(!quit)
+    {
+        auto frame_start = clock::now();
+        bool changed = false;
+
+        SDL_Event event;
+        while(SDL_PollEvent(&event))
+        {
+            if(event.type == SDL_QUIT)
+                quit = true;
+            else if(event.type == SDL_MOUSEMOTION)
+            {
+                if(event.motion.state & SDL_BUTTON_LMASK){
+                    controller.orbit(-0.005 * event.motion.xrel, 0.005 * event.motion.yrel);
+                    changed = true;
+                } else if(event.motion.state & SDL_BUTTON_RMASK){
+                    controller.move(-0.002 * event.motion.xrel, 0.002 * event.motion.yrel, 0);
+                    changed = true;
+                }
+            }
+            else if(event.type == SDL_MOUSEWHEEL)
+            {
+                controller.dolly(event.wheel.y > 0 ? 0.9 : 1.1);
+                changed = true;
+            }
+            else if(event.type == SDL_KEYDOWN)
+            {
+                switch(event.key.keysym.sym){
+                    case SDLK_ESCAPE : quit = true; break;
+                    case SDLK_r : controller.reset(); changed = true; break;
+                    case SDLK_p : {
+                        camera c = controller.make_camera(aspect_ratio);
+                        std::cerr << "\npoint3 lookfrom(" << c.lookfrom.x << "," << c.lookfrom.y << "," << c.lookfrom.z << ");\n"
+                                  << "point3 lookat(" << c.lookat.x << "," << c.lookat.y << "," << c.lookat.z << ");" << std::endl;
+                        break;
+                    }
+                    default : break;
+                }
+            }
+        }
+
+        // continuous moves with the keyboard, a fraction of the orbit distance per frame
+        const Uint8 *keys = SDL_GetKeyboardState(NULL);
+        double step = 0.03 * (keys[SDL_SCANCODE_LSHIFT] ? 4.0 : 1.0);
+        double right = (keys[SDL_SCANCODE_D] ? step : 0) - (keys[SDL_SCANCODE_A] ? step : 0);
+        double up = (keys[SDL_SCANCODE_E] ? step : 0) - (keys[SDL_SCANCODE_Q] ? step : 0);
+        double forward = (keys[SDL_SCANCODE_W] ? step : 0) - (keys[SDL_SCANCODE_S] ? step : 0);
+        if(right != 0 || up != 0 || forward != 0){
+            controller.move(right, up, forward);
+            changed = true;
+        }
+
+        if(changed){
+            // any camera change restarts the accumulation
+            view = controller.make_camera(aspect_ratio);
+            last_change = frame_start;
+            refining = false;
+        }
+
+        bool idle = std::chrono::duration<double>(frame_start - last_change).count() > settings.idle_delay;
+        if(!idle)
+        {
+            // reduced resolution, low depth, one sample
+            low.clear();
+            render_pass(view, world, background, low, settings.moving_depth, 0, frame++);
+            tone_map(low.pixel_list, low.sample_list, low.width, low.height, low_rgb, true);
+            for(int y = 0; y < image_height; ++y){
+                int ly = std::min(low.height - 1, y / scale);
+                for(int x = 0; x < image_width; ++x){
+                    int lx = std::min(low.width - 1, x / scale);
+                    for(int c = 0; c < 3; ++c)
+                        rgb[(x + y * image_width) * 3 + c] = low_rgb[(lx + ly * low.width) * 3 + c];
+                }
+            }
+        }
+        else
+        {
+            if(!refining){
+                fb.clear();
+                next_row = image_height;
+                refining = true;
+            }
+            // full resolution bands, from the top of the image, until the frame budget is spent
+            int band = 16 * thread_count();
+            do {
+                int row_begin = std::max(0, next_row - band);
+                render_rows(view, world, background, fb, max_depth, row_begin, next_row, 0, frame++);
+                next_row = row_begin;
+                if(next_row == 0)
+                    next_row = image_height;
+            } while(std::chrono::duration<double>(clock::now() - frame_start).count() < settings.frame_budget);
+            tone_map(fb.pixel_list, fb.sample_list, image_width, image_height, rgb, true);
+        }
+
+        SDL_UpdateTexture(texture, nullptr, rgb.data(), image_width * 3);
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+
+        frames_since_report++;
+        double since_report = std::chrono::duration<double>(clock::now() - last_report).count();
+        if(since_report > 1.0){
+            char title[128];
+            snprintf(title, sizeof(title), "render - %.1f fps - %u spp", frames_since_report / since_report,
+                refining ? fb.min_samples() : 0);
+            SDL_SetWindowTitle(window, title);
+            frames_since_report = 0;
+            last_report = clock::now();
+        }
+    }
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 0;
+}
+
+#endif
@@ -8,15 +8,29 @@
 #include <map>
 
 #include <algorithm>
+#include <chrono>
+#include <typeinfo>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "material.hpp"
 #include "camera.hpp"
+#include "framebuffer.hpp"
+#include "output.hpp"
+#include "objparser.hpp"
+#include "scenefile.hpp"
+#include "trace.hpp"
 
 #include "struct/vec3.hpp"
 #include "struct/hittable_list.hpp"
 #include "struct/sphere.hpp"
 #include "struct/triangle.hpp"
 #include "struct/bvh.hpp"
+#include "struct/quantized_bvh.hpp"
+#include "struct/paged_mesh.hpp"
+#include "struct/arena.hpp"
 
 std::string pathname( const std::string& filename )
 {
@@ -38,55 +52,9 @@ std::string pathname( const std::string& filename )
 #endif
 }
 
-void write_image(std::vector<color> & pixel_list, const int image_width, const int image_height, 
-    const int samples_per_pixel){
-        
-        int bytes_per_pixel = 3;
-        unsigned char * data;
-        float * datahdr;
-        data = new unsigned char[pixel_list.size()*bytes_per_pixel];
-        datahdr = new float[pixel_list.size()*bytes_per_pixel];
-
-        for (int j = image_height-1; j >= 0; --j) {
-            for (int i = image_width-1; i >= 0; --i) {
-                double r = pixel_list[offset(i,j,image_height,image_width)].x;
-                double g = pixel_list[offset(i,j,image_height,image_width)].y;
-                double b = pixel_list[offset(i,j,image_height,image_width)].z;
-
-                // Divide the color by the number of samples and gamma-correct for gamma=2.0.
-                double scale = 1.0 / samples_per_pixel;
-                r = sqrt(scale * r);
-                g = sqrt(scale * g);
-                b = sqrt(scale * b);
-                
-                // Write the translated [0,255] value of each color component.
-                data[(i + (image_height-j-1) * image_width)*3] = static_cast<unsigned char>(256 * clamp(r, 0.0, 0.999));
-                data[(i + (image_height-j-1) * image_width)*3+1] = static_cast<unsigned char>(256 * clamp(g, 0.0, 0.999));
-                data[(i + (image_height-j-1) * image_width)*3+2] = static_cast<unsigned char>(256 * clamp(b, 0.0, 0.999));
-
-                // Write the translated [0,255] value of each color component.
-                datahdr[(i + (image_height-j-1) * image_width)*3] = float(r);
-                datahdr[(i + (image_height-j-1) * image_width)*3+1] = float(g);
-                datahdr[(i + (image_height-j-1) * image_width)*3+2] = float(b);
-            }
-        }
-
-        if(stbi_write_png("result.png", image_width, image_height, bytes_per_pixel, data, 0) == 1){
-            std::cerr << "image png generated" << std::endl;
-        }
-        if(stbi_write_bmp("result.bmp", image_width, image_height, bytes_per_pixel, data) == 1){
-            std::cerr << "image bmp generated" << std::endl;
-        }
-        if(stbi_write_hdr("result.hdr", image_width, image_height, bytes_per_pixel, datahdr) == 1){
-            std::cerr << "image hdr generated" << std::endl;
-        }
-
-        free(data);
-        free(datahdr);
-}
-
 std::map<std::string,shared_ptr<material>> read_materials( const char *filename )
 {
+    RT_TRACE("read_materials");
     std::map<std::string,shared_ptr<material>> materials;
     std::vector<std::string> namematerial;
     std::vector<color> colormaterial;
@@ -95,7 +63,7 @@ std::map<std::string,shared_ptr<material>> read_materials( const char *filename
     if(in == NULL)
     {
         printf("[error] loading materials '%s'...\n", filename);
-        materials.insert(std::pair<std::string, shared_ptr<material>>("white",make_shared<lambertian>(color(0.5,0.5,0.5))));
+        materials.insert(std::pair<std::string, shared_ptr<material>>("white",scene_new<lambertian>(color(0.5,0.5,0.5))));
         return materials;
     }
     
@@ -155,9 +123,9 @@ std::map<std::string,shared_ptr<material>> read_materials( const char *filename
     }
     for(int i = 0; i < namematerial.size(); ++i){
         if(colormaterial[i*3+2].x != 0 || colormaterial[i*3+2].y != 0 || colormaterial[i*3+2].z != 0){
-            materials.insert(std::pair<std::string, shared_ptr<material>>(namematerial[i],make_shared<diffuse_light>(colormaterial[i*3+2])));
+            materials.insert(std::pair<std::string, shared_ptr<material>>(namematerial[i],scene_new<diffuse_light>(colormaterial[i*3+2])));
         } else {
-            materials.insert(std::pair<std::string, shared_ptr<material>>(namematerial[i],make_shared<lambertian>(colormaterial[i*3])));
+            materials.insert(std::pair<std::string, shared_ptr<material>>(namematerial[i],scene_new<lambertian>(colormaterial[i*3])));
         }
     }
     
@@ -168,7 +136,8 @@ std::map<std::string,shared_ptr<material>> read_materials( const char *filename
     return materials;
 }
 
-hittable_list read_obj( const char *filename)
+// Reference loader, fgets / sscanf line by line. Kept to check read_obj, see compare_obj_loaders.
+hittable_list read_obj_legacy( const char *filename)
 {
     hittable_list world;
     FILE *in= fopen(filename, "rt");
@@ -276,7 +245,7 @@ hittable_list read_obj( const char *filename)
                     if(n >= 0) normal.push_back(normals[n]);
                     abc.push_back(positions[p]);
                 }
-                world.add(make_shared<triangle>(abc[0], abc[1], abc[2], materials[materialName]));
+                world.add(scene_new<triangle>(abc[0], abc[1], abc[2], materials[materialName]));
             }
         }
         
@@ -306,6 +275,122 @@ hittable_list read_obj( const char *filename)
     return world;
 }
 
+hittable_list read_obj_paged( const char *filename, const obj_mesh& mesh, const std::vector<shared_ptr<material>>& materials)
+{
+    hittable_list world;
+    std::vector<uint32_t> paged;
+    paged.reserve(mesh.triangles.size());
+    for(size_t i = 0; i < mesh.triangles.size(); ++i){
+        const obj_triangle& t = mesh.triangles[i];
+        shared_ptr<material> mat = t.material < 0 ? nullptr : materials[t.material];
+        if(mat && mat->isMaterialLight())
+            world.add(scene_new<triangle>(mesh.positions[t.a], mesh.positions[t.b], mesh.positions[t.c], mat));
+        else
+            paged.push_back(i);
+    }
+
+    RT_TRACE("build_pages");
+    auto pages = scene_new<paged_mesh>();
+    bool built = pages->build(paged.size(), [&](size_t i, point3 v[3], int& material){
+        const obj_triangle& t = mesh.triangles[paged[i]];
+        v[0] = mesh.positions[t.a];
+        v[1] = mesh.positions[t.b];
+        v[2] = mesh.positions[t.c];
+        material = t.material;
+    }, materials);
+    if(built)
+        world.add(pages);
+    else if(!paged.empty())
+        std::cerr << "[error] paging mesh " << filename << std::endl;
+
+    std::cerr << mesh.triangles.size() << " element load, " << paged.size() << " in pages" << std::endl;
+    return world;
+}
+
+hittable_list read_obj( const char *filename)
+{
+    RT_TRACE("read_obj");
+    hittable_list world;
+    std::cerr << "loading mesh " << filename << "...\n";
+
+    obj_mesh mesh;
+    {
+        RT_TRACE("parse_obj");
+        if(!parse_obj(filename, mesh))
+            return world;
+    }
+
+    std::vector<std::map<std::string,shared_ptr<material>>> libraries;
+    for(const std::string& library : mesh.libraries)
+        libraries.push_back(read_materials( std::string(pathname(filename) + library).c_str() ));
+
+    // missing names give a null material, as materials[materialName] did
+    std::vector<shared_ptr<material>> materials;
+    for(const obj_material_ref& ref : mesh.materials)
+        materials.push_back(ref.library < 0 ? nullptr : libraries[ref.library][ref.name]);
+
+    // out of core : the triangles go in the pages of a paged_mesh, but the lights, sampled
+    // by the renderer, stay triangles
+    if(out_of_core().enabled)
+        return read_obj_paged(filename, mesh, materials);
+
+    auto make_triangle = [&](size_t i){
+        const obj_triangle& t = mesh.triangles[i];
+        return triangle(mesh.positions[t.a], mesh.positions[t.b], mesh.positions[t.c],
+            t.material < 0 ? nullptr : materials[t.material]);
+    };
+    // one contiguous range of triangles in the arena of the scene
+    if(current_arena() != nullptr)
+        current_arena()->make_array<triangle>(mesh.triangles.size(), make_triangle, world.objects);
+    else {
+        world.objects.resize(mesh.triangles.size());
+        #pragma omp parallel for schedule(static)
+        for(int i = 0; i < (int) mesh.triangles.size(); ++i)
+            world.objects[i] = make_shared<triangle>(make_triangle(i));
+    }
+
+    if(mesh.error)
+        std::cerr << "loading mesh "<< filename << "[error]" << mesh.error_line <<"...\n" << std::endl;
+
+    std::cerr << world.objects.size() << " element load, " << mesh.bytes / 1e6 << " MB parsed in "
+              << mesh.seconds * 1000 << " ms (" << mesh.bytes / 1e6 / std::max(mesh.seconds, 1e-9) << " MB/s)" << std::endl;
+    return world;
+}
+
+// Load filename with both loaders and compare the triangles, vertex by vertex.
+bool compare_obj_loaders( const char *filename )
+{
+    auto start = std::chrono::steady_clock::now();
+    hittable_list reference = read_obj_legacy(filename);
+    double legacy_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    hittable_list fast = read_obj(filename);
+    double fast_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << "legacy " << legacy_seconds * 1000 << " ms, fast " << fast_seconds * 1000 << " ms" << std::endl;
+
+    if(reference.objects.size() != fast.objects.size())
+    {
+        std::cerr << "[error] " << reference.objects.size() << " triangles, read_obj " << fast.objects.size() << std::endl;
+        return false;
+    }
+    size_t differences = 0;
+    for(size_t i = 0; i < fast.objects.size(); ++i){
+        const triangle *a = static_cast<const triangle *>(reference.objects[i].get());
+        const triangle *b = static_cast<const triangle *>(fast.objects[i].get());
+        bool same_material = (a->mat_ptr == nullptr) == (b->mat_ptr == nullptr)
+            && (a->mat_ptr == nullptr || typeid(*a->mat_ptr) == typeid(*b->mat_ptr));
+        auto same = [](const point3& u, const point3& v){ return u.x == v.x && u.y == v.y && u.z == v.z; };
+        if(!same(a->a, b->a) || !same(a->b, b->b) || !same(a->c, b->c) || !same_material){
+            if(differences++ == 0)
+                std::cerr << "[error] triangle " << i << " differs" << std::endl;
+        }
+    }
+    std::cerr << fast.objects.size() << " triangles, " << differences << " differences" << std::endl;
+    return differences == 0;
+}
+
 void open_cornell(hittable_list & mesh, camera & cam, double aspect_ratio)
 {
      // World
@@ -348,10 +433,10 @@ void open_sponza(hittable_list & world, camera & cam, double aspect_ratio)
         }
     }
 
-    auto difflight = make_shared<diffuse_light>(color(4,4,4));
-    world.add(make_shared<sphere>(point3(0, 25, 0), 5, difflight));
+    auto difflight = scene_new<diffuse_light>(color(4,4,4));
+    world.add(scene_new<sphere>(point3(0, 25, 0), 5, difflight));
 
-    world.add(make_shared<bvh_node>(objects, 0, 1));
+    world.add(scene_new<bvh_node>(objects, 0, 1));
     std::cerr << std::endl;
 
     point3 lookfrom(15,2,0);
@@ -369,21 +454,21 @@ void open_spaceship(hittable_list & world, camera & cam, double aspect_ratio)
     // world = read_obj("../data/ufo_plane_free.obj");
 
     // add earth
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("../data/earthmap.jpg"));
-    world.add(make_shared<sphere>(point3(-100, -45, -61), 100, emat));
+    auto emat = scene_new<lambertian>(scene_new<image_texture>("../data/earthmap.jpg"));
+    world.add(scene_new<sphere>(point3(-100, -45, -61), 100, emat));
 
     // add light
-    auto difflight = make_shared<diffuse_light>(make_shared<image_texture>("../data/soleil.jpg"));
-    world.add(make_shared<sphere>(point3(71, 11, 227), 50, difflight));
+    auto difflight = scene_new<diffuse_light>(scene_new<image_texture>("../data/soleil.jpg"));
+    world.add(scene_new<sphere>(point3(71, 11, 227), 50, difflight));
 
     // add mini light (star)
-    auto random_color = make_shared<lambertian>(make_shared<image_texture>("../data/makemake.jpg"));
+    auto random_color = scene_new<lambertian>(scene_new<image_texture>("../data/makemake.jpg"));
     int ns = 500;
     for (int j = 0; j < ns; j++) {
         point3 alea(point3::random(-500,500));
         alea.z = 300;
         // auto random_color = make_shared<lambertian>(color(random_double(0,1),random_double(0,1),random_double(0,1)));
-        world.add(make_shared<sphere>(alea, random_double(0.1,2), random_color));
+        world.add(scene_new<sphere>(alea, random_double(0.1,2), random_color));
     }
 
     point3 lookfrom(71,11,-227);
@@ -402,16 +487,16 @@ void open_bigguy(hittable_list & world, camera & cam, double aspect_ratio)
     hittable_list objects = read_obj("../data/bigguy.obj");
 
     // adding light
-    auto difflight = make_shared<diffuse_light>(color(4,4,4));
+    auto difflight = scene_new<diffuse_light>(color(4,4,4));
     point3 a(10,10,10);
     point3 b(20,10,10);
     point3 c(10,20,10);
     point3 d(10,10,20);
-    objects.add(make_shared<triangle>(a,d,c,difflight));
-    objects.add(make_shared<triangle>(a,b,d,difflight));
+    objects.add(scene_new<triangle>(a,d,c,difflight));
+    objects.add(scene_new<triangle>(a,b,d,difflight));
 
     //create BVH 
-    world.add(make_shared<bvh_node>(objects, 0, 1));
+    world.add(scene_new<bvh_node>(objects, 0, 1));
     std::cerr << std::endl;
 
     point3 lookfrom(20,5,50);
@@ -460,23 +545,23 @@ void open_sportCar(hittable_list & world, camera & cam, double aspect_ratio)
         }
     }
 
-    auto difflight = make_shared<diffuse_light>(color(4,4,4));
+    auto difflight = scene_new<diffuse_light>(color(4,4,4));
     point3 a(-10,2,-10);
     point3 b(-10,2,10);
     point3 c(10,2,-10);
     point3 d(10,2,10);
-    world.add(make_shared<triangle>(a,d,c,difflight));
-    world.add(make_shared<triangle>(a,b,d,difflight));
+    world.add(scene_new<triangle>(a,d,c,difflight));
+    world.add(scene_new<triangle>(a,b,d,difflight));
 
-    auto wall = make_shared<lambertian>(color(0.8,0.8,0.8));
+    auto wall = scene_new<lambertian>(color(0.8,0.8,0.8));
     c = color(-10,0,-10);
     d = color(-10,0,10);
 
-    objects.add(make_shared<triangle>(a,d,c,wall));
-    objects.add(make_shared<triangle>(a,b,d,wall));
+    objects.add(scene_new<triangle>(a,d,c,wall));
+    objects.add(scene_new<triangle>(a,b,d,wall));
 
     //create BVH 
-    world.add(make_shared<bvh_node>(objects, 0, 1));
+    world.add(scene_new<bvh_node>(objects, 0, 1));
 
     point3 lookfrom(50,1.8,50);
     point3 lookat(5,0.5,5);
@@ -498,47 +583,204 @@ void final_scene(hittable_list & objects, camera & cam, const int image_width, c
     auto aperture = 0.0;
     auto dist_to_focus = (lookfrom-lookat).length();
 
-    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+    auto ground = scene_new<lambertian>(color(0.48, 0.83, 0.53));
 
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+    auto light = scene_new<diffuse_light>(color(7, 7, 7));
 
     point3 a(123,127,554);
     point3 b(443,412,554);
     point3 c(123,412,554);
     point3 d(443,127,554);
-    objects.add(make_shared<triangle>(a, b, c, light));
-    objects.add(make_shared<triangle>(a, b, d, light));
+    objects.add(scene_new<triangle>(a, b, c, light));
+    objects.add(scene_new<triangle>(a, b, d, light));
 
 
     auto center1 = point3(400, 400, 200);
     auto center2 = center1 + vec3(30,0,0);
-    auto moving_sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
+    auto moving_sphere_material = scene_new<lambertian>(color(0.7, 0.3, 0.1));
 
-    objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    objects.add(make_shared<sphere>(
-        point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
+    objects.add(scene_new<sphere>(point3(260, 150, 45), 50, scene_new<dielectric>(1.5)));
+    objects.add(scene_new<sphere>(
+        point3(0, 150, 145), 50, scene_new<metal>(color(0.8, 0.8, 0.9), 1.0)
     ));
 
-    auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
+    auto boundary = scene_new<sphere>(point3(360,150,145), 70, scene_new<dielectric>(1.5));
     objects.add(boundary);
-    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("../data/earthmap.jpg"));
-    objects.add(make_shared<sphere>(point3(400,200,400), 100, emat));
-    auto pertext = make_shared<noise_texture>(0.1);
-    objects.add(make_shared<sphere>(point3(220,280,300), 80, make_shared<lambertian>(pertext)));
+    boundary = scene_new<sphere>(point3(0, 0, 0), 5000, scene_new<dielectric>(1.5));
+
+    auto emat = scene_new<lambertian>(scene_new<image_texture>("../data/earthmap.jpg"));
+    objects.add(scene_new<sphere>(point3(400,200,400), 100, emat));
+    auto pertext = scene_new<noise_texture>(0.1);
+    auto marble = scene_new<sphere>(point3(220,280,300), 80, scene_new<lambertian>(pertext));
+    objects.add(marble);
+    aabb marble_box;
+    if (noise_bake_resolution() > 0 && marble->bounding_box(0, 1, marble_box)) {
+        pertext->bake(marble_box, noise_bake_resolution());
+        std::cerr << "noise baked : " << pertext->baked_bytes() / 1e6 << " MB" << std::endl;
+    }
 
     hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto white = scene_new<lambertian>(color(.73, .73, .73));
     int ns = 1000;
     for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
+        boxes2.add(scene_new<sphere>(point3::random(0,165), 10, white));
     }
 
-    objects.add(make_shared<bvh_node>(boxes2, 0.0, 1.0));
+    objects.add(scene_new<bvh_node>(boxes2, 0.0, 1.0));
 
     cam = camera(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
 
 }
 
+// A loaded scene : geometry, light sources, camera and background. The objects are
+// stored in the arena, declared first to be destroyed last.
+struct scene {
+    shared_ptr<scene_arena> arena = make_shared<scene_arena>();
+    shared_ptr<scene_arena> bvh_arena;      // bvh_node trees left uncompressed, see load_scene
+    hittable_list world;
+    std::vector<shared_ptr <hittable> > lights;
+    camera cam;
+    color background;
+};
+
+// Names accepted by load_scene.
+const std::vector<std::string>& scene_names()
+{
+    static const std::vector<std::string> names = {
+        "cornell_empty", "cornell", "test", "sportcar", "sponza", "spaceship", "bigguy", "final"
+    };
+    return names;
+}
+
+bool scene_exists(const std::string& name)
+{
+    if(is_scene_file(name))
+        return access(name.c_str(), R_OK) == 0;
+    const std::vector<std::string>& names = scene_names();
+    return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+// resident memory of the process (Linux), 0 when unknown
+size_t resident_bytes()
+{
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if(statm == NULL)
+        return 0;
+    unsigned long pages = 0, resident = 0;
+    if(fscanf(statm, "%lu %lu", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return size_t(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// Replace the bvh_node trees of the scene by their compact version. The trees were built
+// in trees : released here, unless one of them is still used (too deep to be quantized).
+void compress_scene_bvh(scene& sc, const bvh_layout layout, shared_ptr<scene_arena>& trees)
+{
+    if(layout == bvh_pointers)
+        return;
+    bool kept = false;
+    for(auto& object : sc.world.objects){
+        if(auto tree = std::dynamic_pointer_cast<bvh_node>(object))
+            object = compress_bvh(tree, layout);
+        kept = kept || dynamic_cast<bvh_node *>(object.get()) != nullptr;
+    }
+    for(auto& light : sc.lights)
+        kept = kept || dynamic_cast<bvh_node *>(light.get()) != nullptr;
+    if(kept){
+        sc.bvh_arena = trees;
+        return;
+    }
+    size_t before = resident_bytes();
+    trees.reset();
+#ifdef __GLIBC__
+    malloc_trim(0);     // the freed blocks back to the system
+#endif
+    std::cerr << "bvh_node trees released : resident " << before / 1e6 << " -> " << resident_bytes() / 1e6 << " MB" << std::endl;
+}
+
+bool load_scene(const std::string& name, scene& sc, const double aspect_ratio, const int image_width,
+    const bvh_layout layout = scene_bvh_layout())
+{
+    RT_TRACE("load_scene");
+    // everything built by scene_new until the end of the load goes in the arena, but the
+    // bvh_node trees of a compact layout, temporary
+    arena_scope scope(*sc.arena);
+    shared_ptr<scene_arena> trees = make_shared<scene_arena>();
+    type_arena_scope<bvh_node> trees_scope(layout != bvh_pointers ? trees.get() : nullptr);
+
+    // compiled with --compile-scene
+    if(is_scene_file(name)){
+        if(!read_scene_file(name, sc.world, sc.lights, sc.cam, sc.background, aspect_ratio))
+            return false;
+        compress_scene_bvh(sc, layout, trees);
+        return true;
+    }
+
+    if(!scene_exists(name))
+    {
+        std::cerr << "[error] unknown scene " << name << ", available :";
+        for(const std::string& n : scene_names())
+            std::cerr << " " << n;
+        std::cerr << std::endl;
+        return false;
+    }
+
+    hittable_list mesh;
+    sc.background = color(0,0,0);
+    if(name == "cornell_empty")
+        open_cornell_empty(mesh, sc.cam, aspect_ratio);
+    else if(name == "cornell")
+        open_cornell(mesh, sc.cam, aspect_ratio);
+    else if(name == "test")
+        open_test(mesh, sc.cam, aspect_ratio);
+    else if(name == "sportcar"){
+        open_sportCar(mesh, sc.cam, aspect_ratio);
+        sc.background = color(0.8,0.8,0.8);
+    }
+    else if(name == "sponza"){
+        open_sponza(mesh, sc.cam, aspect_ratio);
+        sc.background = color(0.1,0.1,0.1);
+    }
+    else if(name == "spaceship")
+        open_spaceship(mesh, sc.cam, aspect_ratio);
+    else if(name == "bigguy")
+        open_bigguy(mesh, sc.cam, aspect_ratio);
+    else if(name == "final")
+        final_scene(mesh, sc.cam, image_width, aspect_ratio);
+
+    // create BVH
+    // sc.world.add(make_shared<bvh_node>(mesh, 0, 1));
+    sc.world = mesh;
+    std::cerr << std::endl;
+
+    if(name == "cornell_empty"){
+        // world.add(make_shared<sphere>(point3(0,3.5,0),1,make_shared<dielectric>(1.5)));
+        // world.add(make_shared<sphere>(point3(-3,3.5,-1.5),1,make_shared<metal>(color(0.8,0.8,0.8),1)));
+
+        auto matmetal = scene_new<metal>(color(0.8,0.6,0.2),0.1);
+        auto dielec = scene_new<dielectric>(1.5);
+        auto emat = scene_new<lambertian>(scene_new<image_texture>("../data/earthmap.jpg"));
+        sc.world.add(scene_new<sphere>(point3(0.5,0.5,-0.1),0.4,matmetal));
+        sc.world.add(scene_new<sphere>(point3(-0.5,0.5,-0.2),0.4,dielec));
+        sc.world.add(scene_new<sphere>(point3(-0.5,0.5,-0.2),0.3,emat));
+    }
+
+    // decode the images of the scene, in parallel, unless they are loaded on first use
+    texture_cache::instance().load_pending();
+    texture_cache::instance().report();
+
+    // add light 
+    for (int i = 0; i < mesh.objects.size(); ++i){
+        if(mesh.objects[i]->have_material_light()){
+            sc.lights.push_back(mesh.objects[i]);
+            sc.world.add(mesh.objects[i]);
+        }
+    }
+    std::cerr << "light : " << sc.lights.size() << std::endl;
+    compress_scene_bvh(sc, layout, trees);
+    sc.arena->report();
+    return true;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,159 @@
+#ifndef LARGEFRAME_H
+#define LARGEFRAME_H
+
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "utility.hpp"
+#include "camera.hpp"
+#include "exr.hpp"
+#include "output.hpp"
+#include "ioutility.hpp"
+#include "render.hpp"
+
+// Large frames (posters) : the image is rendered by bands of rows, from the top, without
+// a framebuffer of the whole image. Every pixel of a band takes all its samples at once,
+// the average is kept in floats, then the band is converted and streamed to the files
+// (exr and ppm, the formats that can be written a band at a time) on another thread while
+// the next band renders. Two bands live at a time, whatever the size of the image :
+//
+//   band  : width x band_rows x (3 floats + 3 bytes)
+//
+// The sampler is seeded once per row, so the image does not depend on the thread count
+// nor on the band size.
+
+struct large_frame_settings {
+    int image_width;
+    int image_height;
+    int samples_per_pixel;
+    int max_depth;
+    unsigned int seed;
+    int band_rows = 64;
+    std::string basename = "result";
+};
+
+// Rows [first_line, first_line + rows[ of the image, line 0 at the top.
+struct frame_band {
+    int first_line = 0;
+    int rows = 0;
+    std::vector<float> linear;          // average radiance, 3 per pixel
+    std::vector<unsigned char> rgb;     // gamma 2, 8 bits
+};
+
+const unsigned int large_frame_stream = 0x6c617267;     // sampler stream of the band rows
+
+void render_band(const camera& cam, hittable& world, color& background, frame_band& band,
+    const large_frame_settings& settings)
+{
+    const int image_width = settings.image_width;
+    const int image_height = settings.image_height;
+    const int spp = settings.samples_per_pixel;
+    RT_TRACE_ARG("render_band", band.first_line);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int l = 0; l < band.rows; ++l) {
+        int j = image_height - 1 - (band.first_line + l);
+        seed_sampler(settings.seed, 0, j, large_frame_stream);
+        float *line = band.linear.data() + size_t(l) * image_width * 3;
+        for (int i = 0; i < image_width; ++i) {
+            color pixel_color(0, 0, 0);
+            for (int s = 0; s < spp; ++s) {
+                auto u = (i + random_double()) / (image_width-1);
+                auto v = (j + random_double()) / (image_height-1);
+                ray r = cam.get_ray(u, v, 1.0 / (image_width-1), 1.0 / (image_height-1));
+                pixel_color += indirect_ray_color(r, background, world, settings.max_depth, s, 0);
+            }
+            pixel_color /= spp;
+            for (int c = 0; c < 3; ++c)
+                line[i*3 + c] = float(pixel_color[c]);
+        }
+    }
+}
+
+// Same conversion as convert_image, for the rows of a band.
+void convert_band(frame_band& band, const int width)
+{
+    size_t n = size_t(band.rows) * width * 3;
+    for (size_t k = 0; k < n; ++k)
+        band.rgb[k] = static_cast<unsigned char>(256 * clamp(sqrt(double(band.linear[k])), 0.0, 0.999));
+}
+
+int render_large_frame(scene& sc, const large_frame_settings& settings)
+{
+    const int width = settings.image_width;
+    const int height = settings.image_height;
+    const int band_rows = std::max(1, std::min(settings.band_rows, height));
+
+    unsigned int formats = output_formats() & (format_exr | format_exr32 | format_ppm);
+    if (output_formats() & ~(format_exr | format_exr32 | format_ppm))
+        std::cerr << "[warning] large frames are only written in exr and ppm" << std::endl;
+    if (formats == 0)
+        formats = format_exr;
+
+    exr_writer exr;
+    ppm_writer ppm;
+    if ((formats & format_exr) && !exr.open(settings.basename + ".exr", width, height, exr_channels(formats)))
+        return -1;
+    if ((formats & format_ppm) && !ppm.open(settings.basename + ".ppm", width, height))
+        return -1;
+
+    frame_band bands[2];
+    for (frame_band& band : bands) {
+        band.linear.resize(size_t(band_rows) * width * 3);
+        band.rgb.resize((formats & format_ppm) ? band.linear.size() : 0);
+    }
+    double band_mb = 2 * (bands[0].linear.size() * sizeof(float) + bands[0].rgb.size()) / 1e6;
+    double framebuffer_mb = double(width) * height * (sizeof(color) + sizeof(double) + sizeof(unsigned int)) / 1e6;
+    std::cerr << "large frame " << width << "x" << height << " : bands of " << band_rows << " rows, "
+              << band_mb << " MB of buffers (a framebuffer would take " << framebuffer_mb << " MB)" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    const int band_count = (height + band_rows - 1) / band_rows;
+    std::future<bool> pending;
+    bool ok = true;
+    for (int b = 0; b < band_count && ok; ++b) {
+        std::cerr << "\rBands remaining : " << band_count - b << "    " << std::flush;
+        frame_band& band = bands[b % 2];
+        band.first_line = b * band_rows;
+        band.rows = std::min(band_rows, height - band.first_line);
+        render_band(sc.cam, sc.world, sc.background, band, settings);
+
+        // the other band is free once its lines are written
+        if (pending.valid())
+            ok = pending.get();
+        pending = std::async(std::launch::async, [&band, &exr, &ppm, formats, width]{
+            RT_TRACE_ARG("write_band", band.first_line);
+            bool written = true;
+            if (formats & format_exr)
+                written = exr.write_lines(band.first_line, band.rows, band.linear.data()) && written;
+            if (formats & format_ppm) {
+                convert_band(band, width);
+                written = ppm.write_lines(band.first_line, band.rows, band.rgb.data()) && written;
+            }
+            return written;
+        });
+    }
+    if (pending.valid())
+        ok = pending.get() && ok;
+    if (formats & format_exr)
+        ok = exr.close() && ok;
+    if (formats & format_ppm)
+        ok = ppm.close() && ok;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << std::endl;
+
+    if (!ok) {
+        std::cerr << "[error] writing " << settings.basename << std::endl;
+        return -1;
+    }
+    if (formats & format_exr)
+        std::cerr << "image exr generated" << std::endl;
+    if (formats & format_ppm)
+        std::cerr << "image ppm generated" << std::endl;
+    std::cerr << settings.samples_per_pixel << " samples per pixel in " << elapsed.count() << " s" << std::endl;
+    return 0;
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define MATERIAL_H
 
 #include "utility.hpp"
+#include "stats.hpp"
 #include "struct/texture.hpp"
 
 struct hit_record;
@@ -11,7 +12,7 @@ class material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const = 0;
-        virtual color emitted(double u, double v, const point3& p) const {
+        virtual color emitted(double u, double v, const point3& p, double /*footprint*/) const {
             return color(0,0,0);
         }
         virtual bool isMaterialLight() const {
@@ -24,12 +25,13 @@ class material {
 
 class lambertian : public material {
     public:
-        lambertian(const color& a) : albedo(make_shared<solid_color>(a)) {}
+        lambertian(const color& a) : albedo(scene_new<solid_color>(a)) {}
         lambertian(shared_ptr<texture> a) : albedo(a) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
+            RT_STAT(scatters[stat_lambertian]++);
             auto scatter_direction = rec.normal + random_unit_vector();
 
             // Catch degenerate scatter direction
@@ -37,7 +39,7 @@ class lambertian : public material {
                 scatter_direction = rec.normal;
 
             scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
             return true;
         }
 
@@ -52,6 +54,7 @@ class metal : public material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
+            RT_STAT(scatters[stat_metal]++);
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
             scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
             attenuation = albedo;
@@ -74,6 +77,7 @@ class dielectric : public material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
+            RT_STAT(scatters[stat_dielectric]++);
             attenuation = color(1.0, 1.0, 1.0);
             double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
 
@@ -105,23 +109,29 @@ class dielectric : public material {
             // Use Schlick's approximation for reflectance.
             auto r0 = (1-ref_idx) / (1+ref_idx);
             r0 = r0*r0;
+#ifdef RT_FAST_MATH
+            auto x = 1 - cosine, x2 = x*x;
+            return r0 + (1-r0)*x2*x2*x;
+#else
             return r0 + (1-r0)*pow((1 - cosine),5);
+#endif
         }
 };
 
 class diffuse_light : public material  {
     public:
         diffuse_light(shared_ptr<texture> a) : emit(a) {}
-        diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
+        diffuse_light(color c) : emit(scene_new<solid_color>(c)) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
+            RT_STAT(scatters[stat_diffuse_light]++);
             return false;
         }
 
-        virtual color emitted(double u, double v, const point3& p) const override {
-            return emit->value(u, v, p);
+        virtual color emitted(double u, double v, const point3& p, double footprint) const override {
+            return emit->value(u, v, p, footprint);
         }
 
         virtual bool isMaterialLight() const override{
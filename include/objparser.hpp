@@ -0,0 +1,431 @@
+#ifndef OBJPARSER_H
+#define OBJPARSER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utility.hpp"
+#include "struct/vec3.hpp"
+
+// Fast OBJ parser : the file is mapped in memory, cut in chunks at line boundaries and
+// the chunks are parsed in parallel. Faces keep their raw indices and the position count
+// of their chunk, the relative indices (< 0) and the materials are resolved by a serial
+// merge pass, in file order. Only the geometry used by read_obj is kept : positions,
+// triangles (fan of each face) and the mtllib / usemtl state of each triangle.
+//
+// Accepts the same lines as the fgets / sscanf loader : "v x y z", "vt", "vn", "f" with
+// p, p/t, p//n or p/t/n vertices, "mtllib name", "usemtl name". Parsing stops on the
+// first invalid v / vt / vn line, like the old loader.
+
+// Triangle of the merged mesh, material is an index in obj_mesh::materials.
+struct obj_triangle {
+    int a, b, c;
+    int material;
+};
+
+// Material of a triangle : name given by usemtl, in the library of the last mtllib (-1 : none).
+struct obj_material_ref {
+    int library;
+    std::string name;
+};
+
+struct obj_mesh {
+    std::vector<point3> positions;
+    std::vector<obj_triangle> triangles;
+    std::vector<std::string> libraries;
+    std::vector<obj_material_ref> materials;
+    bool error = false;
+    std::string error_line;
+    size_t bytes = 0;
+    double seconds = 0;
+};
+
+namespace obj {
+
+// 10^k, exact in double up to 22
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+inline const char *skip_blanks(const char *p, const char *end)
+{
+    while(p < end && is_blank(*p))
+        p++;
+    return p;
+}
+
+// strtof on a copy of the token, the mapping is not terminated by a 0.
+inline const char *slow_float(const char *p, const char *end, float& value)
+{
+    char token[64];
+    size_t n = 0;
+    while(p + n < end && n + 1 < sizeof(token) && !is_blank(p[n]) && p[n] != '\n')
+    {
+        token[n] = p[n];
+        n++;
+    }
+    token[n] = 0;
+    char *stop;
+    value = strtof(token, &stop);
+    return stop == token ? nullptr : p + (stop - token);
+}
+
+// Same result as sscanf %f : the decimal is converted exactly when the digits and the
+// exponent fit a double (Clinger fast path), and by strtof otherwise.
+// Returns the end of the number, nullptr when there is no number.
+inline const char *parse_float(const char *p, const char *end, float& value)
+{
+    const char *start = p;
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    while(p < end && is_digit(*p)){
+        if(mantissa != 0 || *p != '0') digits++;
+        mantissa = mantissa * 10 + (*p++ - '0');
+        any = true;
+    }
+    if(p < end && *p == '.'){
+        p++;
+        while(p < end && is_digit(*p)){
+            if(mantissa != 0 || *p != '0') digits++;
+            mantissa = mantissa * 10 + (*p++ - '0');
+            exponent--;
+            any = true;
+        }
+    }
+    if(!any || digits > 19)
+        return slow_float(start, end, value);
+
+    if(p < end && (*p == 'e' || *p == 'E')){
+        const char *q = p + 1;
+        bool negative_exponent = false;
+        if(q < end && (*q == '-' || *q == '+'))
+            negative_exponent = (*q++ == '-');
+        if(q < end && is_digit(*q)){
+            int e = 0;
+            while(q < end && is_digit(*q)){
+                if(e < 10000) e = e * 10 + (*q - '0');
+                q++;
+            }
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+    // hexadecimal, inf, nan...
+    if(p < end && !is_blank(*p) && *p != '\n' && *p != '/')
+        return slow_float(start, end, value);
+
+    if(mantissa > (uint64_t(1) << 53) || exponent < -22 || exponent > 22)
+        return slow_float(start, end, value);
+
+    double d = double(mantissa);
+    d = exponent < 0 ? d / exact_powers[-exponent] : d * exact_powers[exponent];
+
+    // d is the correctly rounded double, rounding it again to float is only wrong when
+    // it lands exactly half way between two floats
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    if((bits & 0x1FFFFFFF) == 0x10000000)
+        return slow_float(start, end, value);
+
+    value = float(negative ? -d : d);
+    return p;
+}
+
+inline const char *parse_int(const char *p, const char *end, int& value)
+{
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+    if(p >= end || !is_digit(*p))
+        return nullptr;
+    long v = 0;
+    while(p < end && is_digit(*p)){
+        if(v < INT32_MAX) v = v * 10 + (*p - '0');
+        p++;
+    }
+    value = int(negative ? -v : v);
+    return p;
+}
+
+// "keyword name" : name up to the end of the line, false if the keyword does not match.
+inline bool parse_name(const char *p, const char *end, const char *keyword, std::string& name)
+{
+    size_t n = strlen(keyword);
+    if(size_t(end - p) < n || memcmp(p, keyword, n) != 0)
+        return false;
+    p = skip_blanks(p + n, end);
+    const char *q = p;
+    while(q < end && *q != '\r' && *q != '\n')
+        q++;
+    if(q == p)
+        return false;
+    name.assign(p, q);
+    return true;
+}
+
+enum command_type { command_mtllib, command_usemtl };
+
+// mtllib / usemtl, applied before the face number face of the chunk.
+struct command {
+    size_t face;
+    command_type type;
+    std::string name;
+};
+
+struct face {
+    uint32_t first;         // first index in chunk::indices
+    uint32_t count;
+    uint32_t positions;     // positions of the chunk read before this face
+};
+
+struct chunk {
+    const char *begin, *end;
+    std::vector<point3> positions;
+    std::vector<int> indices;
+    std::vector<face> faces;
+    std::vector<command> commands;
+    bool error = false;
+    std::string error_line;
+};
+
+inline void parse_chunk(chunk& c)
+{
+    const char *p = c.begin;
+    const char *end = c.end;
+    std::string name;
+
+    while(p < end)
+    {
+        const char *line = skip_blanks(p, end);
+        while(line < end && *line == '\n')
+            line = skip_blanks(line + 1, end);
+        const char *eol = static_cast<const char *>(memchr(line, '\n', end - line));
+        if(eol == nullptr) eol = end;
+        p = eol + 1;
+        if(line >= end)
+            break;
+
+        if(line[0] == 'v' && line + 1 < eol)
+        {
+            int components = 0;
+            if(line[1] == ' ') components = 3;
+            else if(line[1] == 'n') components = 3;
+            else if(line[1] == 't') components = 2;
+            if(components == 0)
+                continue;
+
+            float v[3] = {0, 0, 0};
+            const char *q = line + 2;
+            int i = 0;
+            for(; i < components; ++i){
+                q = skip_blanks(q, eol);
+                q = parse_float(q, eol, v[i]);
+                if(q == nullptr) break;
+            }
+            if(i < components)
+            {
+                c.error = true;
+                c.error_line.assign(line, eol);
+                return;
+            }
+            if(line[1] == ' ')
+                c.positions.push_back(point3(v[0], v[1], v[2]));
+        }
+
+        else if(line[0] == 'f')
+        {
+            face f;
+            f.first = c.indices.size();
+            f.positions = c.positions.size();
+            const char *q = line + 1;
+            for(;;)
+            {
+                q = skip_blanks(q, eol);
+                int index;
+                const char *next = parse_int(q, eol, index);
+                if(next == nullptr)
+                    break;
+                // texcoord / normal indices are not used
+                if(next < eol && *next == '/'){
+                    next++;
+                    int unused;
+                    const char *t = parse_int(next, eol, unused);
+                    if(t != nullptr) next = t;
+                    if(next < eol && *next == '/'){
+                        t = parse_int(next + 1, eol, unused);
+                        if(t != nullptr) next = t;
+                    }
+                }
+                c.indices.push_back(index);
+                q = next;
+            }
+            f.count = c.indices.size() - f.first;
+            c.faces.push_back(f);
+        }
+
+        else if(line[0] == 'm')
+        {
+            if(parse_name(line, eol, "mtllib", name))
+                c.commands.push_back({c.faces.size(), command_mtllib, name});
+        }
+
+        else if(line[0] == 'u')
+        {
+            if(parse_name(line, eol, "usemtl", name))
+                c.commands.push_back({c.faces.size(), command_usemtl, name});
+        }
+    }
+}
+
+} // namespace obj
+
+// Parse filename in memory, false if the file can not be read.
+bool parse_obj(const char *filename, obj_mesh& mesh)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) < 0)
+    {
+        std::cerr << "[error] loading mesh " << filename << std::endl;
+        if(fd >= 0) close(fd);
+        return false;
+    }
+    size_t size = info.st_size;
+    mesh.bytes = size;
+    if(size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        std::cerr << "[error] mapping mesh " << filename << std::endl;
+        return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    const char *data = static_cast<const char *>(mapping);
+    const char *data_end = data + size;
+
+    // chunks of about 1MB, at least a few per thread, cut after a '\n'
+    size_t count = std::max<size_t>(1, std::min<size_t>(size >> 20, 4096));
+    count = std::min(std::max<size_t>(count, 4 * thread_count()), std::max<size_t>(1, size >> 16));
+    std::vector<obj::chunk> chunks(count);
+    const char *begin = data;
+    for(size_t i = 0; i < count; ++i){
+        const char *end = (i + 1 == count) ? data_end : data + size * (i + 1) / count;
+        if(end < begin) end = begin;
+        if(end < data_end){
+            const char *eol = static_cast<const char *>(memchr(end, '\n', data_end - end));
+            end = eol ? eol + 1 : data_end;
+        }
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        begin = end;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int i = 0; i < (int) count; ++i)
+        obj::parse_chunk(chunks[i]);
+
+    // merge, in file order, into vectors sized once, freeing each chunk once merged : the
+    // parse peaks near one copy of the mesh, not the chunks and the mesh side by side
+    size_t position_count = 0, triangle_count = 0;
+    for(const obj::chunk& c : chunks){
+        position_count += c.positions.size();
+        for(const obj::face& face : c.faces)
+            triangle_count += face.count > 2 ? face.count - 2 : 0;
+    }
+    mesh.positions.reserve(position_count);
+    mesh.triangles.reserve(triangle_count);
+
+    int library = -1;
+    int material = -1;
+    std::map<std::pair<int, std::string>, int> material_ids;
+    for(obj::chunk& c : chunks)
+    {
+        int base = mesh.positions.size();
+        mesh.positions.insert(mesh.positions.end(), c.positions.begin(), c.positions.end());
+
+        size_t next_command = 0;
+        for(size_t f = 0; f <= c.faces.size(); ++f)
+        {
+            for(; next_command < c.commands.size() && c.commands[next_command].face == f; ++next_command){
+                const obj::command& command = c.commands[next_command];
+                if(command.type == obj::command_mtllib){
+                    library = mesh.libraries.size();
+                    mesh.libraries.push_back(command.name);
+                }
+                std::string name = command.type == obj::command_usemtl ? command.name
+                    : (material < 0 ? std::string() : mesh.materials[material].name);
+                auto key = std::make_pair(library, name);
+                auto found = material_ids.find(key);
+                if(found == material_ids.end()){
+                    found = material_ids.insert(std::make_pair(key, (int) mesh.materials.size())).first;
+                    mesh.materials.push_back({library, name});
+                }
+                material = found->second;
+            }
+            if(f == c.faces.size())
+                break;
+
+            const obj::face& face = c.faces[f];
+            const int *idp = c.indices.data() + face.first;
+            int positions = base + face.positions;
+            int id[3];
+            for(int v = 2; v < (int) face.count; v++)
+            {
+                int idv[3] = { 0, v - 1, v };
+                int i = 0;
+                for(; i < 3; i++){
+                    int k = idp[idv[i]];
+                    id[i] = (k < 0) ? positions + k : k - 1;
+                    if(id[i] < 0 || id[i] >= (int) mesh.positions.size()) break;
+                }
+                if(i < 3)
+                    continue;   // invalid index, the old loader read out of the array
+                mesh.triangles.push_back({id[0], id[1], id[2], material});
+            }
+        }
+
+        if(c.error){
+            mesh.error = true;
+            mesh.error_line = c.error_line;
+            break;
+        }
+        c = obj::chunk();
+    }
+
+    munmap(mapping, size);
+    mesh.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+#endif
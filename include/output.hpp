@@ -0,0 +1,232 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstdio>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "utility.hpp"
+#include "framebuffer.hpp"
+#include "exr.hpp"
+#include "trace.hpp"
+#include "struct/rtw_stb_image.hpp"
+
+// Output of the rendered image : the framebuffer is converted in parallel (one row per
+// iteration), then every requested format is encoded on its own thread.
+//
+//   png, bmp : 8 bits, gamma 2
+//   hdr      : radiance hdr of the gamma 2 values, as before
+//   exr      : OpenEXR half, linear average radiance, for compositing
+//   exr32    : the same exr in float channels, lossless
+//   ppm      : binary ppm of the png values, written a band of lines at a time
+//
+// image_writer does the encoding in the background, for the snapshots of a progressive
+// render : the render goes on while the previous snapshot is written.
+
+// format_exr32 only changes the channels of format_exr to float
+enum image_format { format_png = 1, format_bmp = 2, format_hdr = 4, format_exr = 8, format_ppm = 16, format_exr32 = 32 };
+
+// formats written by write_image, set with --format
+inline unsigned int& output_formats() {
+    static unsigned int formats = format_png | format_bmp | format_hdr;
+    return formats;
+}
+
+// "png,exr" -> format_png | format_exr, 0 if a name is unknown
+unsigned int parse_formats(const std::string& list)
+{
+    unsigned int formats = 0;
+    std::stringstream names(list);
+    std::string name;
+    while(std::getline(names, name, ',')){
+        if(name == "png") formats |= format_png;
+        else if(name == "bmp") formats |= format_bmp;
+        else if(name == "hdr") formats |= format_hdr;
+        else if(name == "exr") formats |= format_exr;
+        else if(name == "exr32") formats |= format_exr | format_exr32;
+        else if(name == "ppm") formats |= format_ppm;
+        else {
+            std::cerr << "[error] unknown image format " << name << std::endl;
+            return 0;
+        }
+    }
+    return formats;
+}
+
+inline exr_pixel_type exr_channels(const unsigned int formats) {
+    return (formats & format_exr32) ? exr_float : exr_half;
+}
+
+// Converted image, top row first, 3 values per pixel.
+struct image_buffers {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> rgb;     // png, bmp, ppm
+    std::vector<float> hdr;             // hdr, gamma 2
+    std::vector<float> linear;          // exr
+};
+
+void convert_image(const framebuffer& fb, const unsigned int formats, image_buffers& image)
+{
+    RT_TRACE("convert_image");
+    const int image_width = fb.width;
+    const int image_height = fb.height;
+    image.width = image_width;
+    image.height = image_height;
+    image.rgb.resize((formats & (format_png | format_bmp | format_ppm)) ? fb.size() * 3 : 0);
+    image.hdr.resize((formats & format_hdr) ? fb.size() * 3 : 0);
+    image.linear.resize((formats & format_exr) ? fb.size() * 3 : 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int j = image_height-1; j >= 0; --j) {
+        for (int i = 0; i < image_width; ++i) {
+            unsigned int k = offset(i,j,image_height,image_width);
+            size_t p = size_t(i + (image_height-j-1) * image_width) * 3;
+
+            // Divide the color by the number of samples of the pixel and gamma-correct for gamma=2.0.
+            double scale = fb.sample_list[k] > 0 ? 1.0 / fb.sample_list[k] : 0.0;
+            color average = scale * fb.pixel_list[k];
+            for (int c = 0; c < 3; ++c) {
+                double value = sqrt(average[c]);
+                if (!image.rgb.empty())
+                    image.rgb[p + c] = static_cast<unsigned char>(256 * clamp(value, 0.0, 0.999));
+                if (!image.hdr.empty())
+                    image.hdr[p + c] = float(value);
+                if (!image.linear.empty())
+                    image.linear[p + c] = float(average[c]);
+            }
+        }
+    }
+}
+
+// Binary ppm (P6), 8 bits rgb. The header only holds the size, so the lines can be
+// written in order as they are rendered.
+class ppm_writer {
+    public:
+        ppm_writer() : out(NULL), width(0), height(0), next_line(0) {}
+        ~ppm_writer() { close(); }
+
+        bool open(const std::string& filename, int w, int h) {
+            close();
+            width = w;
+            height = h;
+            next_line = 0;
+            out = fopen(filename.c_str(), "wb");
+            if(out == NULL)
+            {
+                std::cerr << "[error] writing " << filename << std::endl;
+                return false;
+            }
+            return fprintf(out, "P6\n%d %d\n255\n", width, height) > 0;
+        }
+
+        // count lines starting at line y (0 : top of the image), 3 bytes per pixel
+        bool write_lines(int y, int count, const unsigned char *rgb) {
+            if(out == NULL || y != next_line || y + count > height)
+                return false;
+            size_t size = size_t(count) * width * 3;
+            if(fwrite(rgb, 1, size, out) != size)
+                return false;
+            next_line += count;
+            return true;
+        }
+
+        // false if the lines were not all written
+        bool close() {
+            if(out == NULL)
+                return true;
+            bool complete = next_line == height;
+            complete = (fclose(out) == 0) && complete;
+            out = NULL;
+            return complete;
+        }
+
+    private:
+        FILE *out;
+        int width, height;
+        int next_line;
+};
+
+bool write_ppm(const std::string& filename, int width, int height, const unsigned char *rgb)
+{
+    ppm_writer writer;
+    return writer.open(filename, width, height)
+        && writer.write_lines(0, height, rgb)
+        && writer.close();
+}
+
+// Encode the formats concurrently, false if one failed.
+bool encode_image(const image_buffers& image, const std::string& basename, const unsigned int formats)
+{
+    const int w = image.width;
+    const int h = image.height;
+    std::future<bool> png, bmp, hdr, exr, ppm;
+    if(formats & format_png)
+        png = std::async(std::launch::async, [&]{ RT_TRACE("encode_png"); return stbi_write_png((basename + ".png").c_str(), w, h, 3, image.rgb.data(), 0) == 1; });
+    if(formats & format_bmp)
+        bmp = std::async(std::launch::async, [&]{ RT_TRACE("encode_bmp"); return stbi_write_bmp((basename + ".bmp").c_str(), w, h, 3, image.rgb.data()) == 1; });
+    if(formats & format_hdr)
+        hdr = std::async(std::launch::async, [&]{ RT_TRACE("encode_hdr"); return stbi_write_hdr((basename + ".hdr").c_str(), w, h, 3, image.hdr.data()) == 1; });
+    if(formats & format_exr)
+        exr = std::async(std::launch::async, [&]{ RT_TRACE("encode_exr"); return write_exr(basename + ".exr", w, h, image.linear.data(), exr_channels(formats)); });
+    if(formats & format_ppm)
+        ppm = std::async(std::launch::async, [&]{ RT_TRACE("encode_ppm"); return write_ppm(basename + ".ppm", w, h, image.rgb.data()); });
+
+    // messages in a fixed order, once every encoder is done
+    bool ok = true;
+    const char *names[5] = {"png", "bmp", "hdr", "exr", "ppm"};
+    std::future<bool> *results[5] = {&png, &bmp, &hdr, &exr, &ppm};
+    for(int f = 0; f < 5; ++f){
+        if(!results[f]->valid())
+            continue;
+        if(results[f]->get())
+            std::cerr << "image " << names[f] << " generated" << std::endl;
+        else {
+            std::cerr << "[error] writing " << basename << "." << names[f] << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void write_image(const framebuffer & fb, const std::string& basename = "result")
+{
+    RT_TRACE("write_image");
+    image_buffers image;
+    convert_image(fb, output_formats(), image);
+    encode_image(image, basename, output_formats());
+}
+
+// Background writer : convert now, encode on another thread.
+class image_writer {
+    public:
+        ~image_writer() { wait(); }
+
+        // false when the previous image is still being encoded and skip_if_busy is set
+        bool submit(const framebuffer& fb, const std::string& basename, const bool skip_if_busy = true) {
+            if(pending.valid()){
+                if(skip_if_busy && pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    return false;
+                pending.get();
+            }
+            auto image = std::make_shared<image_buffers>();
+            unsigned int formats = output_formats();
+            convert_image(fb, formats, *image);
+            pending = std::async(std::launch::async, [image, basename, formats]{
+                return encode_image(*image, basename, formats);
+            });
+            return true;
+        }
+
+        bool wait() {
+            return pending.valid() ? pending.get() : true;
+        }
+
+    private:
+        std::future<bool> pending;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "utility.hpp"
+#include "framebuffer.hpp"
+
+// Preview window running on its own thread. The render never touches SDL : it only
+// hands a copy of its framebuffer to publish(), and only when the display thread asked
+// for a new frame, so the cost on the render side is at most one copy per displayed frame.
+// The display thread owns SDL (init, window, renderer, events), tone-maps the snapshot
+// into a streaming texture and presents it at max_fps at most.
+class preview_window {
+    public:
+        preview_window(int w, int h, int fps = 30)
+            : width(w), height(h), max_fps(fps), running(false), ready(false), failed(false),
+              window_closed(false), frame_wanted(true), frame_pending(false) {}
+
+        ~preview_window() {
+            stop();
+        }
+
+        // Start the display thread, false if SDL could not open the window.
+        bool start() {
+            running = true;
+            display = std::thread(&preview_window::run, this);
+            // wait until the window exists, or failed to
+            while (running && !ready && !failed)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return !failed;
+        }
+
+        void stop() {
+            running = false;
+            if (display.joinable())
+                display.join();
+        }
+
+        // true once the user closed the window
+        bool closed() const { return window_closed; }
+
+        // Called by the render between passes. Cheap when no frame is wanted.
+        void publish(const framebuffer& fb) {
+            if (!frame_wanted.exchange(false))
+                return;
+            std::lock_guard<std::mutex> guard(lock);
+            back_pixels = fb.pixel_list;
+            back_samples = fb.sample_list;
+            frame_pending = true;
+        }
+
+    private:
+        void run() {
+            if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+                std::cerr << "Failed to initialize the SDL2 library\n";
+                failed = true;
+                return;
+            }
+
+            SDL_Window *window = SDL_CreateWindow("render",
+                                                SDL_WINDOWPOS_CENTERED,
+                                                SDL_WINDOWPOS_CENTERED,
+                                                width, height,
+                                                0);
+            SDL_Renderer *renderer = window ? SDL_CreateRenderer(window, -1, 0) : nullptr;
+            SDL_Texture *texture = renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24,
+                SDL_TEXTUREACCESS_STREAMING, width, height) : nullptr;
+            if (!texture) {
+                std::cerr << "Failed to create preview window : " << SDL_GetError() << std::endl;
+                if (renderer) SDL_DestroyRenderer(renderer);
+                if (window) SDL_DestroyWindow(window);
+                SDL_Quit();
+                failed = true;
+                return;
+            }
+            ready = true;
+
+            std::vector<color> pixels;
+            std::vector<unsigned int> samples;
+            std::vector<unsigned char> rgb(width * height * 3);
+            const auto frame_time = std::chrono::microseconds(1000000 / max_fps);
+
+            while (running) {
+                auto frame_start = std::chrono::steady_clock::now();
+
+                SDL_Event event;
+                while (SDL_PollEvent(&event)) {
+                    if (event.type == SDL_QUIT)
+                        window_closed = true;
+                }
+
+                bool have_frame = false;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (frame_pending) {
+                        pixels.swap(back_pixels);
+                        samples.swap(back_samples);
+                        frame_pending = false;
+                        have_frame = true;
+                    }
+                }
+
+                if (have_frame) {
+                    tone_map(pixels, samples, width, height, rgb);
+                    SDL_UpdateTexture(texture, nullptr, rgb.data(), width * 3);
+                    SDL_RenderClear(renderer);
+                    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+                    SDL_RenderPresent(renderer);
+                }
+                // ask the render for the next frame
+                frame_wanted = true;
+
+                std::this_thread::sleep_until(frame_start + frame_time);
+            }
+
+            SDL_DestroyTexture(texture);
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+        }
+
+    private:
+        int width, height;
+        int max_fps;
+        std::thread display;
+        std::mutex lock;
+        std::vector<color> back_pixels;
+        std::vector<unsigned int> back_samples;
+        std::atomic<bool> running;
+        std::atomic<bool> ready;
+        std::atomic<bool> failed;
+        std::atomic<bool> window_closed;
+        std::atomic<bool> frame_wanted;
+        bool frame_pending;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "utility.hpp"
+#include "framebuffer.hpp"
+
+// One entry per progressive pass, written next to the image at the end of the render.
+struct pass_record {
+    int pass;
+    int samples;        // samples per pixel reached at the end of the pass
+    double seconds;     // wall clock since the start of the render
+    double error;       // estimated image-wide relative error
+};
+
+// Estimate the relative RMS error of the image from the per-pixel luminance variance.
+double estimate_relative_error(const framebuffer& fb)
+{
+    if (fb.min_samples() < 2)
+        return infinity;
+
+    double accum = 0.0;
+    #pragma omp parallel for reduction(+:accum)
+    for (int i = 0; i < (int) fb.size(); ++i) {
+        double samples = fb.sample_list[i];
+        double mean = luminance(fb.pixel_list[i]) / samples;
+        double variance = std::max(0.0, fb.luminance_list[i] / samples - mean * mean) * samples / (samples - 1);
+        // variance of the pixel estimate, relative to its value (epsilon keeps dark pixels from dominating)
+        accum += variance / samples / (mean * mean + 1e-3);
+    }
+    return sqrt(accum / fb.size());
+}
+
+// Decide when a progressive render stops and when to write intermediate images.
+// A zero budget, target or interval disables the corresponding criterion.
+class progressive_control {
+    public:
+        progressive_control(double budget, double target, double interval)
+            : time_budget(budget), noise_target(target), snapshot_interval(interval),
+              last_snapshot(0.0)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+
+        double elapsed() const {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        void record(int samples, double error) {
+            passes.push_back({(int) passes.size(), samples, elapsed(), error});
+        }
+
+        // true when the last pass reached the noise target, or when the next pass
+        // would not fit in the remaining time budget.
+        bool should_stop() const {
+            if (passes.empty())
+                return false;
+            const pass_record& last = passes.back();
+            if (noise_target > 0 && last.error <= noise_target)
+                return true;
+            if (time_budget > 0) {
+                double pass_time = last.seconds / passes.size();
+                if (last.seconds + pass_time > time_budget)
+                    return true;
+            }
+            return false;
+        }
+
+        bool snapshot_due() {
+            if (snapshot_interval <= 0)
+                return false;
+            double now = elapsed();
+            if (now - last_snapshot < snapshot_interval)
+                return false;
+            last_snapshot = now;
+            return true;
+        }
+
+        bool write_log(const char *filename) const {
+            FILE *out = fopen(filename, "wt");
+            if (out == NULL)
+                return false;
+
+            int samples = passes.empty() ? 0 : passes.back().samples;
+            fprintf(out, "{\n  \"samples\": %d,\n  \"seconds\": %g,\n", samples, elapsed());
+            fprintf(out, "  \"time_budget\": %g,\n  \"noise_target\": %g,\n", time_budget, noise_target);
+            fprintf(out, "  \"passes\": [\n");
+            for (size_t i = 0; i < passes.size(); ++i) {
+                const pass_record& p = passes[i];
+                fprintf(out, "    {\"pass\": %d, \"samples\": %d, \"seconds\": %g, \"error\": %g}%s\n",
+                    p.pass, p.samples, p.seconds, std::isinf(p.error) ? -1.0 : p.error,
+                    i + 1 < passes.size() ? "," : "");
+            }
+            fprintf(out, "  ]\n}\n");
+            fclose(out);
+            return true;
+        }
+
+    public:
+        double time_budget;         // seconds
+        double noise_target;        // relative error
+        double snapshot_interval;   // seconds
+        std::vector<pass_record> passes;
+
+    private:
+        std::chrono::steady_clock::time_point start;
+        double last_snapshot;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "utility.hpp"
+#include "camera.hpp"
+#include "material.hpp"
+#include "framebuffer.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "struct/hittable.hpp"
+
+color ray_color(ray& r, color& background, hittable& world, int depth) {
+    hit_record rec;
+
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    if (depth <= 0)
+        return color(0,0,0);
+
+    // If the ray hits nothing, return the background color.
+    RT_STAT(ray(stat_bounce));
+    bool hit = world.hit(r, 0.001, infinity, rec);
+    RT_STAT(traced(stat_bounce, hit));
+    if (!hit)
+        return background;
+    rec.footprint = uv_footprint(r, rec);
+
+    ray scattered;
+    color attenuation;
+    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p, rec.footprint);
+
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+        return emitted;
+
+    return emitted + attenuation * ray_color(scattered, background, world, depth-1);
+}
+
+// Shade the camera ray r at its hit rec : emission plus the scattered path.
+color indirect_hit_color(ray& r, hit_record& rec, color& background, hittable& world, int depth, const int & sample, const int & all_samples) {
+    ray scattered;
+    color attenuation;
+    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p, rec.footprint);
+
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+        return emitted;
+
+    // vec3 b1, b2;
+    // branchlessONB(scattered.dir, b1, b2);
+    // vec3 w = l2w(fibo(sample, all_samples), scattered.dir, b1, b2);
+
+    // ray fiboray(scattered.orig, w);
+
+    return emitted + attenuation * ray_color(scattered, background, world, depth-1);
+    // return emitted + attenuation * ray_color(fiboray, background, world, depth-1);
+}
+
+color indirect_ray_color(ray& r, color& background, hittable& world, int depth, const int & sample, const int & all_samples) {
+    hit_record rec;
+
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    if (depth <= 0)
+        return color(0,0,0);
+
+    // If the ray hits nothing, return the background color.
+    RT_STAT(ray(stat_camera));
+    bool hit = world.hit(r, 0.001, infinity, rec);
+    RT_STAT(traced(stat_camera, hit));
+    if (!hit)
+        return background;
+    rec.footprint = uv_footprint(r, rec);
+
+    return indirect_hit_color(r, rec, background, world, depth, sample, all_samples);
+}
+
+color direct_ray_color(ray& r, color& background, hittable& world, std::vector<shared_ptr <hittable> >& light, int depth, const int & sample, const int & all_samples) {
+    hit_record rec;
+
+    // If the ray hits nothing, return the background color.
+    RT_STAT(ray(stat_camera));
+    bool hit = world.hit(r, 0.001, infinity, rec);
+    RT_STAT(traced(stat_camera, hit));
+    if (!hit)
+        return background;
+
+    // select random light in scene
+    int random_light_id = random_double(0, light.size());
+    auto random_light = light[random_light_id];
+
+    // select random point on light source
+    float u = sqrt(random_double());
+    float v = ( 1.0f - u ) * sqrt(random_double());
+    point3 light_point = random_light->point(u,v);
+
+    // create ray between light point and hit point
+    ray direct_light_ray;
+    direct_light_ray.dir = rec.p - light_point;
+    direct_light_ray.orig = light_point;
+
+    hit_record rec_light;
+    // If the ray hits nothing, there is nothing between light and element, return material color.
+    RT_STAT(ray(stat_shadow));
+    bool occluded = world.hit(direct_light_ray, 0.001, 0.999, rec_light);
+    RT_STAT(traced(stat_shadow, occluded));
+    if (!occluded){
+        color attenuation;
+        rec.footprint = uv_footprint(r, rec);
+        color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p, rec.footprint);
+        ray scatter;
+        if (!rec.mat_ptr->scatter(r, rec, attenuation, scatter))
+            return emitted;
+        // if material is pure color return attenuation
+        if(rec.mat_ptr->isMatMaterial())
+            return attenuation;
+        // otherwise continue the path from this hit, the camera ray is already counted
+        else if (depth <= 0)
+            return color(0,0,0);
+        else
+            return indirect_hit_color(r, rec, background, world, depth, sample, all_samples);
+    }
+    return background;
+}
+
+// Trace one sample for each pixel of the rows [row_begin, row_end[ of fb,
+// with the sampler of every thread seeded from (seed, pass, stream).
+void render_rows(const camera& cam, hittable& world, color& background, framebuffer& fb,
+    const int max_depth, const int row_begin, const int row_end, const unsigned int seed,
+    const unsigned int pass, const unsigned int stream = 0)
+{
+    const int image_width = fb.width;
+    const int image_height = fb.height;
+    #pragma omp parallel
+    {
+        RT_TRACE_ARG("rows", pass);
+        seed_sampler(seed, pass, thread_id(), stream);
+        #pragma omp for schedule(dynamic, 16)
+        for (int j = row_end-1; j >= row_begin; --j) {
+            for (int i = 0; i < image_width; ++i) {
+                color pixel_color(0, 0, 0);
+                auto u = (i + random_double()) / (image_width-1);
+                auto v = (j + random_double()) / (image_height-1);
+                ray r = cam.get_ray(u, v, 1.0 / (image_width-1), 1.0 / (image_height-1));
+                pixel_color = (indirect_ray_color(r, background, world, max_depth, pass, 0)*1
+                            /*+ direct_ray_color(r, background, world, light, max_depth, pass, 0)*0.5*/);
+                fb.add(i, j, pixel_color);
+            }
+        }
+    }
+}
+
+// Trace passes samples for each pixel of the tile [x0, x1[ x [y0, y1[ of an image of
+// image_width x image_height pixels. tile is a framebuffer of the size of the tile.
+void render_tile(const camera& cam, hittable& world, color& background, framebuffer& tile,
+    const int image_width, const int image_height, const int x0, const int y0,
+    const int max_depth, const unsigned int seed, const unsigned int first_pass,
+    const unsigned int passes, const unsigned int stream)
+{
+    RT_TRACE_ARG("render_tile", stream);
+    for (unsigned int pass = first_pass; pass < first_pass + passes; ++pass) {
+        #pragma omp parallel
+        {
+            RT_TRACE_ARG("tile_rows", pass);
+            seed_sampler(seed, pass, thread_id(), stream);
+            #pragma omp for schedule(dynamic, 1)
+            for (int j = tile.height-1; j >= 0; --j) {
+                for (int i = 0; i < tile.width; ++i) {
+                    auto u = (x0 + i + random_double()) / (image_width-1);
+                    auto v = (y0 + j + random_double()) / (image_height-1);
+                    ray r = cam.get_ray(u, v, 1.0 / (image_width-1), 1.0 / (image_height-1));
+                    tile.add(i, j, indirect_ray_color(r, background, world, max_depth, pass, 0));
+                }
+            }
+        }
+    }
+}
+
+void render_pass(const camera& cam, hittable& world, color& background, framebuffer& fb,
+    const int max_depth, const unsigned int seed, const unsigned int pass,
+    const unsigned int stream = 0)
+{
+    RT_TRACE_ARG("render_pass", pass);
+    texture_cache::instance().evict_between_passes();
+    render_rows(cam, world, background, fb, max_depth, 0, fb.height, seed, pass, stream);
+}
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef SCALING_H
+#define SCALING_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <dirent.h>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "utility.hpp"
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "render.hpp"
+#include "struct/hittable.hpp"
+
+// Thread scaling study (--scaling) : the same passes of the scene rendered with 1..N
+// threads, for each pinning of the threads on the cpus :
+//
+//   none    : the threads may run on every allowed cpu (the scheduler decides)
+//   compact : thread t on the t-th allowed cpu, the siblings of a core side by side
+//   scatter : threads spread evenly over the allowed cpus, so over the NUMA nodes
+//
+// The rows are shared with the schedule of --schedule (dynamic,16 as render_rows by
+// default, static, guided,4...). Every thread measures its busy time (its share of the
+// rows), the rest of the pass it waits at the barrier. Reported for each run :
+//
+//   samples/s  : pixel samples per second, over all passes
+//   efficiency : speedup / threads, speedup against the same pinning with the fewest threads
+//   imbalance  : busiest thread / mean busy time (1 : perfect)
+//   idle       : share of thread time spent waiting at the end of the passes
+//
+// with the busy time, samples, last cpu and NUMA node of every thread in scaling.json.
+
+struct scaling_settings {
+    std::vector<int> threads;           // empty : 1, 2, 4 ... thread_count()
+    std::vector<std::string> pinning;   // empty : none
+    std::string schedule = "dynamic,16";
+    int passes = 4;
+    unsigned int seed = 0;
+};
+
+struct thread_load {
+    double busy;        // seconds
+    long long samples;
+    int cpu;
+    int node;
+};
+
+struct scaling_run {
+    int threads;
+    std::string pinning;
+    double seconds;
+    long long samples;
+    std::vector<thread_load> load;
+};
+
+// "1,2,8" -> {1, 2, 8}
+std::vector<int> parse_thread_counts(const std::string& list)
+{
+    std::vector<int> counts;
+    std::stringstream values(list);
+    std::string value;
+    while (std::getline(values, value, ','))
+        if (atoi(value.c_str()) > 0)
+            counts.push_back(atoi(value.c_str()));
+    return counts;
+}
+
+// NUMA node of a cpu, from sysfs, 0 when unknown
+int cpu_node(int cpu)
+{
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR *dir = opendir(path.c_str());
+    if (dir == NULL)
+        return 0;
+    int node = 0;
+    while (struct dirent *entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+std::vector<int> allowed_cpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &set))
+                cpus.push_back(c);
+    return cpus;
+}
+
+// cpu set of thread t of threads for the pinning, every cpu for none
+bool pin_thread(const std::string& pinning, const std::vector<int>& cpus, const int t, const int threads)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pinning == "compact")
+        CPU_SET(cpus[t % cpus.size()], &set);
+    else if (pinning == "scatter")
+        CPU_SET(cpus[(size_t(t) * cpus.size() / threads) % cpus.size()], &set);
+    else
+        for (int c : cpus)
+            CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// "dynamic,16" -> schedule(runtime) of the study loop
+bool set_schedule(const std::string& schedule)
+{
+#ifdef _OPENMP
+    std::string kind = schedule.substr(0, schedule.find(','));
+    int chunk = schedule.find(',') != std::string::npos ? atoi(schedule.c_str() + schedule.find(',') + 1) : 0;
+    if (kind == "static") omp_set_schedule(omp_sched_static, chunk);
+    else if (kind == "dynamic") omp_set_schedule(omp_sched_dynamic, chunk);
+    else if (kind == "guided") omp_set_schedule(omp_sched_guided, chunk);
+    else {
+        std::cerr << "[error] unknown schedule " << schedule << " (static, dynamic or guided, and a chunk size)" << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+scaling_run scaling_render(const camera& cam, hittable& world, color& background, framebuffer& fb,
+    const int max_depth, const scaling_settings& settings, const std::vector<int>& cpus,
+    const std::string& pinning, const int threads)
+{
+    scaling_run run = { threads, pinning, 0, 0, std::vector<thread_load>(threads, thread_load{0, 0, -1, 0}) };
+    const int image_width = fb.width;
+    const int image_height = fb.height;
+    fb.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < settings.passes; ++pass) {
+        #pragma omp parallel num_threads(threads)
+        {
+            const int t = thread_id();
+            if (pass == 0)
+                pin_thread(pinning, cpus, t, threads);
+            seed_sampler(settings.seed, pass, t);
+            long long samples = 0;
+            auto begin = std::chrono::steady_clock::now();
+            #pragma omp for schedule(runtime) nowait
+            for (int j = image_height-1; j >= 0; --j) {
+                for (int i = 0; i < image_width; ++i) {
+                    auto u = (i + random_double()) / (image_width-1);
+                    auto v = (j + random_double()) / (image_height-1);
+                    ray r = cam.get_ray(u, v, 1.0 / (image_width-1), 1.0 / (image_height-1));
+                    fb.add(i, j, indirect_ray_color(r, background, world, max_depth, pass, 0));
+                }
+                samples += image_width;
+            }
+            // once per pass : the blocks of the threads share cache lines
+            thread_load& load = run.load[t];
+            load.busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            load.samples += samples;
+            load.cpu = sched_getcpu();
+        }
+    }
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (thread_load& load : run.load) {
+        load.node = cpu_node(load.cpu);
+        run.samples += load.samples;
+    }
+    return run;
+}
+
+bool write_scaling_log(const char *filename, const std::vector<scaling_run>& runs, const scaling_settings& settings,
+    const int width, const int height, const std::vector<int>& cpus)
+{
+    FILE *out = fopen(filename, "wt");
+    if (out == NULL)
+        return false;
+    fprintf(out, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"passes\": %d,\n  \"schedule\": \"%s\",\n  \"cpus\": %zu,\n  \"runs\": [\n",
+        width, height, settings.passes, settings.schedule.c_str(), cpus.size());
+    for (size_t r = 0; r < runs.size(); ++r) {
+        const scaling_run& run = runs[r];
+        fprintf(out, "    {\"threads\": %d, \"pinning\": \"%s\", \"seconds\": %g, \"samples_per_s\": %g, \"load\": [",
+            run.threads, run.pinning.c_str(), run.seconds, run.samples / run.seconds);
+        for (size_t t = 0; t < run.load.size(); ++t)
+            fprintf(out, "%s{\"busy\": %g, \"samples\": %lld, \"cpu\": %d, \"node\": %d}", t > 0 ? ", " : "",
+                run.load[t].busy, run.load[t].samples, run.load[t].cpu, run.load[t].node);
+        fprintf(out, "]}%s\n", r + 1 < runs.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+int run_scaling(const camera& cam, hittable& world, color& background, const int image_width,
+    const int image_height, const int max_depth, scaling_settings settings)
+{
+    if (!set_schedule(settings.schedule))
+        return -1;
+    const std::vector<int> cpus = allowed_cpus();
+    if (cpus.empty()) {
+        std::cerr << "[error] no cpu in the affinity of the process" << std::endl;
+        return -1;
+    }
+    if (settings.threads.empty())
+        for (int n = 1; ; n *= 2) {
+            settings.threads.push_back(std::min(n, thread_count()));
+            if (n >= thread_count())
+                break;
+        }
+    // ascending : the first run of a pinning is the baseline of its speedups
+    std::sort(settings.threads.begin(), settings.threads.end());
+    settings.threads.erase(std::unique(settings.threads.begin(), settings.threads.end()), settings.threads.end());
+    if (settings.pinning.empty())
+        settings.pinning.push_back("none");
+    for (const std::string& pinning : settings.pinning) {
+        if (pinning != "none" && pinning != "compact" && pinning != "scatter") {
+            std::cerr << "[error] unknown pinning " << pinning << " (none, compact or scatter)" << std::endl;
+            return -1;
+        }
+    }
+    int nodes = 0;
+    for (int c : cpus)
+        nodes = std::max(nodes, cpu_node(c) + 1);
+    std::cerr << "scaling : " << cpus.size() << " cpus on " << nodes << " NUMA nodes, " << settings.passes
+              << " passes of " << image_width << "x" << image_height << ", schedule " << settings.schedule << std::endl;
+#ifdef _OPENMP
+    omp_set_dynamic(0);
+#endif
+
+    // one pass with every thread first : textures decoded, pages mapped, caches warm
+    framebuffer fb(image_width, image_height);
+    scaling_settings warm = settings;
+    warm.passes = 1;
+    scaling_render(cam, world, background, fb, max_depth, warm, cpus, "none", thread_count());
+
+    std::vector<scaling_run> runs;
+    char line[256];
+    snprintf(line, sizeof(line), "  %-8s %7s %9s %12s %8s %10s %9s %6s", "pinning", "threads", "seconds",
+        "samples/s", "speedup", "efficiency", "imbalance", "idle");
+    std::cerr << line << std::endl;
+    for (const std::string& pinning : settings.pinning) {
+        const size_t first = runs.size();
+        for (int threads : settings.threads) {
+            runs.push_back(scaling_render(cam, world, background, fb, max_depth, settings, cpus, pinning, threads));
+            const scaling_run& run = runs.back();
+            const scaling_run& base = runs[first];
+            double busy = 0, busiest = 0;
+            for (const thread_load& load : run.load) {
+                busy += load.busy;
+                busiest = std::max(busiest, load.busy);
+            }
+            double speedup = (run.samples / run.seconds) / (base.samples / base.seconds) * base.threads;
+            snprintf(line, sizeof(line), "  %-8s %7d %9.3f %12.0f %8.2f %9.1f%% %9.2f %5.1f%%", pinning.c_str(),
+                threads, run.seconds, run.samples / run.seconds, speedup, 100 * speedup / threads,
+                busiest / (busy / threads), 100 * (1 - busy / (threads * run.seconds)));
+            std::cerr << line << std::endl;
+        }
+    }
+    if (write_scaling_log("scaling.json", runs, settings, image_width, image_height, cpus))
+        std::cerr << "scaling log generated" << std::endl;
+    return 0;
+}
+
+#endif
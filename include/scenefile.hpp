@@ -0,0 +1,624 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utility.hpp"
+#include "camera.hpp"
+#include "material.hpp"
+
+#include "struct/hittable_list.hpp"
+#include "struct/sphere.hpp"
+#include "struct/triangle.hpp"
+#include "struct/bvh.hpp"
+#include "struct/quantized_bvh.hpp"
+
+// Compiled scene : the geometry, materials, decoded textures and camera of a loaded scene
+// in one binary file, written once with --compile-scene and loaded with --scene file.rts.
+//
+// The file is mapped in memory. Textures are used in place in the mapping, triangles,
+// spheres and materials are built in one array per type, so loading does one allocation
+// per type instead of one per object. Only the BVH is rebuilt.
+//
+// layout (byte order of the machine that compiled it, every section 64 byte aligned) :
+//   header      : scene_file_header, with the offset of every section
+//   triangles   : scene_file_triangle[triangle_count]
+//   spheres     : scene_file_sphere[sphere_count]
+//   materials   : scene_file_material[material_count]
+//   textures    : scene_file_texture[texture_count], then the MIP levels of each texture,
+//                 float texels by tiles as in mip_level, each level 64 byte aligned
+//   references  : scene_file_ref[reference_count] : world objects, lights, then bvh members
+//   groups      : scene_file_group[group_count], the members of each bvh
+
+struct scene_file_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t size;
+    uint32_t triangle_count;
+    uint32_t sphere_count;
+    uint32_t material_count;
+    uint32_t texture_count;
+    uint32_t world_count;
+    uint32_t light_count;
+    uint32_t reference_count;
+    uint32_t group_count;
+    uint64_t triangles;
+    uint64_t spheres;
+    uint64_t materials;
+    uint64_t textures;
+    uint64_t references;
+    uint64_t groups;
+    double background[3];
+    double lookfrom[3];
+    double lookat[3];
+    double vup[3];
+    double vfov;
+    double aperture;
+    double focus_dist;
+};
+
+const uint32_t scene_file_version = 2;
+
+struct scene_file_triangle {
+    double a[3], b[3], c[3];
+    int32_t material;       // -1 : no material
+    uint32_t pad;
+};
+
+struct scene_file_sphere {
+    double center[3];
+    double radius;
+    int32_t material;
+    uint32_t pad;
+};
+
+enum scene_file_material_type : uint32_t {
+    scene_lambertian = 1,
+    scene_metal = 2,
+    scene_dielectric = 3,
+    scene_diffuse_light = 4
+};
+
+struct scene_file_material {
+    uint32_t type;
+    int32_t texture;        // image of the albedo / emission, -1 : solid color
+    double color[3];
+    double parameter;       // fuzz of metal, index of refraction of dielectric
+};
+
+struct scene_file_texture {
+    int32_t width;
+    int32_t height;
+    uint32_t levels;        // down to 1x1, sizes given by mip_size()
+    uint32_t pad;
+    uint64_t texels;        // offset of level 0, the next levels follow
+};
+
+enum scene_file_ref_type : uint32_t { scene_ref_triangle = 0, scene_ref_sphere = 1, scene_ref_bvh = 2 };
+
+struct scene_file_ref {
+    uint32_t type;
+    uint32_t index;         // in triangles, spheres or groups
+};
+
+struct scene_file_group {
+    uint32_t first;         // first member in references
+    uint32_t count;
+};
+
+inline uint64_t align64(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+
+// Flatten a scene in the tables of the file : objects and materials are numbered the
+// first time they are seen, so shared objects (lights in the world and in a bvh) and
+// shared materials are stored once.
+class scene_compiler {
+    public:
+        bool add(const hittable_list& world, const std::vector<shared_ptr<hittable>>& lights) {
+            for(const auto& object : world.objects)
+                reference(object, world_refs);
+            for(const auto& object : lights)
+                reference(object, light_refs);
+            return ok;
+        }
+
+        bool write(const std::string& filename, const camera& cam, const color& background) {
+            scene_file_header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, "RTSC", 4);
+            header.version = scene_file_version;
+            header.triangle_count = triangles.size();
+            header.sphere_count = spheres.size();
+            header.material_count = materials.size();
+            header.texture_count = textures.size();
+            header.world_count = world_refs.size();
+            header.light_count = light_refs.size();
+            header.group_count = groups.size();
+
+            std::vector<scene_file_ref> references = world_refs;
+            references.insert(references.end(), light_refs.begin(), light_refs.end());
+            std::vector<scene_file_group> group_table;
+            for(const auto& members : groups){
+                group_table.push_back({uint32_t(references.size()), uint32_t(members.size())});
+                references.insert(references.end(), members.begin(), members.end());
+            }
+            header.reference_count = references.size();
+
+            uint64_t offset = align64(sizeof(header));
+            header.triangles = offset;  offset = align64(offset + triangles.size() * sizeof(scene_file_triangle));
+            header.spheres = offset;    offset = align64(offset + spheres.size() * sizeof(scene_file_sphere));
+            header.materials = offset;  offset = align64(offset + materials.size() * sizeof(scene_file_material));
+            header.textures = offset;   offset = align64(offset + textures.size() * sizeof(scene_file_texture));
+            for(size_t t = 0; t < textures.size(); ++t){
+                textures[t].texels = offset;
+                for(const mip_level& level : images[t]->levels)
+                    offset = align64(offset + mip_level::floats(level.width, level.height) * sizeof(float));
+            }
+            header.references = offset; offset = align64(offset + references.size() * sizeof(scene_file_ref));
+            header.groups = offset;     offset = align64(offset + group_table.size() * sizeof(scene_file_group));
+            header.size = offset;
+
+            for(int i = 0; i < 3; ++i){
+                header.background[i] = background[i];
+                header.lookfrom[i] = cam.lookfrom[i];
+                header.lookat[i] = cam.lookat[i];
+                header.vup[i] = cam.vup[i];
+            }
+            header.vfov = cam.vfov;
+            header.aperture = cam.aperture;
+            header.focus_dist = cam.focus_dist;
+
+            std::string tmp = filename + ".tmp";
+            FILE *out = fopen(tmp.c_str(), "wb");
+            if(out == NULL)
+            {
+                std::cerr << "[error] writing scene file " << tmp << std::endl;
+                return false;
+            }
+            position = 0;
+            bool written = put(out, &header, sizeof(header), 0)
+                && put(out, triangles.data(), triangles.size() * sizeof(scene_file_triangle), header.triangles)
+                && put(out, spheres.data(), spheres.size() * sizeof(scene_file_sphere), header.spheres)
+                && put(out, materials.data(), materials.size() * sizeof(scene_file_material), header.materials)
+                && put(out, textures.data(), textures.size() * sizeof(scene_file_texture), header.textures);
+            for(size_t t = 0; t < textures.size() && written; ++t){
+                uint64_t level_offset = textures[t].texels;
+                for(const mip_level& level : images[t]->levels){
+                    size_t size = mip_level::floats(level.width, level.height) * sizeof(float);
+                    written = written && put(out, level.texels, size, level_offset);
+                    level_offset = align64(level_offset + size);
+                }
+            }
+            written = written
+                && put(out, references.data(), references.size() * sizeof(scene_file_ref), header.references)
+                && put(out, group_table.data(), group_table.size() * sizeof(scene_file_group), header.groups)
+                && put(out, nullptr, 0, header.size);
+            written = (fclose(out) == 0) && written;
+
+            if(!written || rename(tmp.c_str(), filename.c_str()) != 0)
+            {
+                std::cerr << "[error] writing scene file " << filename << std::endl;
+                remove(tmp.c_str());
+                return false;
+            }
+            std::cerr << "scene file " << filename << " : " << triangles.size() << " triangles, " << spheres.size() << " spheres, "
+                      << materials.size() << " materials, " << textures.size() << " textures, " << header.size / 1e6 << " MB" << std::endl;
+            return true;
+        }
+
+    private:
+        // zero padding up to offset, then size bytes
+        bool put(FILE *out, const void *data, size_t size, uint64_t offset) {
+            static const char zeros[64] = {0};
+            while(position < offset){
+                size_t n = std::min<uint64_t>(sizeof(zeros), offset - position);
+                if(fwrite(zeros, 1, n, out) != n) return false;
+                position += n;
+            }
+            if(size > 0 && fwrite(data, 1, size, out) != size) return false;
+            position += size;
+            return true;
+        }
+
+        void unsupported(const char *what) {
+            std::cerr << "[error] scene file : unsupported " << what << std::endl;
+            ok = false;
+        }
+
+        void reference(const shared_ptr<hittable>& object, std::vector<scene_file_ref>& refs) {
+            const hittable *h = object.get();
+            auto known = objects.find(h);
+            if(known != objects.end()){
+                refs.push_back(known->second);
+                return;
+            }
+
+            scene_file_ref ref;
+            if(const triangle *t = dynamic_cast<const triangle *>(h)){
+                scene_file_triangle record;
+                memset(&record, 0, sizeof(record));
+                for(int i = 0; i < 3; ++i){
+                    record.a[i] = t->a[i];
+                    record.b[i] = t->b[i];
+                    record.c[i] = t->c[i];
+                }
+                record.material = material_id(t->mat_ptr);
+                ref = {scene_ref_triangle, uint32_t(triangles.size())};
+                triangles.push_back(record);
+            }
+            else if(const sphere *s = dynamic_cast<const sphere *>(h)){
+                scene_file_sphere record;
+                memset(&record, 0, sizeof(record));
+                for(int i = 0; i < 3; ++i)
+                    record.center[i] = s->center[i];
+                record.radius = s->radius;
+                record.material = material_id(s->mat_ptr);
+                ref = {scene_ref_sphere, uint32_t(spheres.size())};
+                spheres.push_back(record);
+            }
+            else if(dynamic_cast<const bvh_node *>(h)){
+                // the members are stored, the tree is built again at load time
+                std::vector<scene_file_ref> members;
+                collect(object, members);
+                ref = {scene_ref_bvh, uint32_t(groups.size())};
+                groups.push_back(members);
+            }
+            else if(const std::vector<shared_ptr<hittable>> *leaves = quantized_primitives(h)){
+                std::vector<scene_file_ref> members;
+                for(const auto& leaf : *leaves)
+                    reference(leaf, members);
+                ref = {scene_ref_bvh, uint32_t(groups.size())};
+                groups.push_back(members);
+            }
+            else if(const hittable_list *list = dynamic_cast<const hittable_list *>(h)){
+                for(const auto& o : list->objects)
+                    reference(o, refs);
+                return;
+            }
+            else {
+                unsupported("object");
+                return;
+            }
+            objects[h] = ref;
+            refs.push_back(ref);
+        }
+
+        // leaves of a bvh, nested bvh are merged in the same group
+        void collect(const shared_ptr<hittable>& node, std::vector<scene_file_ref>& members) {
+            if(const bvh_node *b = dynamic_cast<const bvh_node *>(node.get())){
+                collect(b->left, members);
+                if(b->right != b->left)
+                    collect(b->right, members);
+            } else {
+                reference(node, members);
+            }
+        }
+
+        // image index, or -1 and the color of a solid texture
+        int32_t texture_id(const shared_ptr<texture>& tex, double rgb[3]) {
+            if(const solid_color *s = dynamic_cast<const solid_color *>(tex.get())){
+                for(int i = 0; i < 3; ++i)
+                    rgb[i] = s->color_value[i];
+                return -1;
+            }
+            const image_texture *image = dynamic_cast<const image_texture *>(tex.get());
+            if(image == nullptr){
+                unsupported("texture");
+                return -1;
+            }
+            // textures of the same file share their pixels in the cache, and one record here
+            const texture_pixels *pixels = image->image ? image->image->get() : nullptr;
+            auto known = texture_ids.find(pixels);
+            if(known != texture_ids.end())
+                return known->second;
+
+            scene_file_texture record;
+            memset(&record, 0, sizeof(record));
+            // an image that failed to load stays cyan, as 1x1 pixel
+            static const unsigned char cyan[3] = {0, 255, 255};
+            static const texture_pixels missing(cyan, 1, 1);
+            if(pixels == nullptr)
+                pixels = &missing;
+            record.width = pixels->width();
+            record.height = pixels->height();
+            record.levels = pixels->levels.size();
+            int32_t id = textures.size();
+            textures.push_back(record);
+            images.push_back(pixels);
+            texture_ids[image->image ? image->image->get() : nullptr] = id;
+            return id;
+        }
+
+        int32_t material_id(const shared_ptr<material>& mat) {
+            if(mat == nullptr)
+                return -1;
+            auto known = material_ids.find(mat.get());
+            if(known != material_ids.end())
+                return known->second;
+
+            scene_file_material record;
+            memset(&record, 0, sizeof(record));
+            record.texture = -1;
+            if(const lambertian *m = dynamic_cast<const lambertian *>(mat.get())){
+                record.type = scene_lambertian;
+                record.texture = texture_id(m->albedo, record.color);
+            } else if(const metal *m = dynamic_cast<const metal *>(mat.get())){
+                record.type = scene_metal;
+                for(int i = 0; i < 3; ++i)
+                    record.color[i] = m->albedo[i];
+                record.parameter = m->fuzz;
+            } else if(const dielectric *m = dynamic_cast<const dielectric *>(mat.get())){
+                record.type = scene_dielectric;
+                record.parameter = m->ir;
+            } else if(const diffuse_light *m = dynamic_cast<const diffuse_light *>(mat.get())){
+                record.type = scene_diffuse_light;
+                record.texture = texture_id(m->emit, record.color);
+            } else {
+                unsupported("material");
+            }
+            int32_t id = materials.size();
+            materials.push_back(record);
+            material_ids[mat.get()] = id;
+            return id;
+        }
+
+    private:
+        bool ok = true;
+        uint64_t position = 0;
+        std::vector<scene_file_triangle> triangles;
+        std::vector<scene_file_sphere> spheres;
+        std::vector<scene_file_material> materials;
+        std::vector<scene_file_texture> textures;
+        std::vector<const texture_pixels *> images;
+        std::vector<std::vector<scene_file_ref>> groups;
+        std::vector<scene_file_ref> world_refs;
+        std::vector<scene_file_ref> light_refs;
+        std::map<const hittable *, scene_file_ref> objects;
+        std::map<const material *, int32_t> material_ids;
+        std::map<const texture_pixels *, int32_t> texture_ids;
+};
+
+bool write_scene_file(const std::string& filename, const hittable_list& world,
+    const std::vector<shared_ptr<hittable>>& lights, const camera& cam, const color& background)
+{
+    scene_compiler compiler;
+    if(!compiler.add(world, lights))
+        return false;
+    return compiler.write(filename, cam, background);
+}
+
+// Objects of a loaded scene file, one array per type. The world holds aliasing pointers
+// on the storage, which keeps the mapping alive. The materials and textures referenced
+// inside the storage are plain (non owning) pointers, to avoid a cycle.
+struct scene_file_storage {
+    void *mapping = nullptr;
+    size_t size = 0;
+    std::vector<image_texture> images;
+    std::vector<solid_color> colors;
+    std::vector<lambertian> lambertians;
+    std::vector<metal> metals;
+    std::vector<dielectric> dielectrics;
+    std::vector<diffuse_light> lights;
+    std::vector<triangle> triangles;
+    std::vector<sphere> spheres;
+
+    ~scene_file_storage() {
+        // the images point in the mapping
+        images.clear();
+        if(mapping)
+            munmap(mapping, size);
+    }
+};
+
+template <typename T>
+shared_ptr<T> borrow(T *object) {
+    return shared_ptr<T>(object, [](T *){});
+}
+
+bool is_scene_file(const std::string& name)
+{
+    return name.size() > 4 && name.compare(name.size() - 4, 4, ".rts") == 0;
+}
+
+bool read_scene_file(const std::string& filename, hittable_list& world, std::vector<shared_ptr<hittable>>& lights,
+    camera& cam, color& background, const double aspect_ratio)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) < 0 || size_t(info.st_size) < sizeof(scene_file_header))
+    {
+        std::cerr << "[error] loading scene file " << filename << std::endl;
+        if(fd >= 0) close(fd);
+        return false;
+    }
+    auto storage = std::make_shared<scene_file_storage>();
+    storage->size = info.st_size;
+    storage->mapping = mmap(nullptr, storage->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(storage->mapping == MAP_FAILED)
+    {
+        storage->mapping = nullptr;
+        std::cerr << "[error] mapping scene file " << filename << std::endl;
+        return false;
+    }
+    const char *base = static_cast<const char *>(storage->mapping);
+    const scene_file_header& header = *reinterpret_cast<const scene_file_header *>(base);
+
+    auto fits = [&](uint64_t offset, uint64_t count, size_t size){
+        return offset % 64 == 0 && offset <= header.size && count <= (header.size - offset) / size;
+    };
+    bool valid = memcmp(header.magic, "RTSC", 4) == 0 && header.version == scene_file_version
+        && header.size == storage->size
+        && fits(header.triangles, header.triangle_count, sizeof(scene_file_triangle))
+        && fits(header.spheres, header.sphere_count, sizeof(scene_file_sphere))
+        && fits(header.materials, header.material_count, sizeof(scene_file_material))
+        && fits(header.textures, header.texture_count, sizeof(scene_file_texture))
+        && fits(header.references, header.reference_count, sizeof(scene_file_ref))
+        && fits(header.groups, header.group_count, sizeof(scene_file_group))
+        && uint64_t(header.world_count) + header.light_count <= header.reference_count;
+    if(!valid)
+    {
+        std::cerr << "[error] " << filename << " is not a scene file (version " << scene_file_version << ")" << std::endl;
+        return false;
+    }
+
+    const scene_file_triangle *triangles = reinterpret_cast<const scene_file_triangle *>(base + header.triangles);
+    const scene_file_sphere *spheres = reinterpret_cast<const scene_file_sphere *>(base + header.spheres);
+    const scene_file_material *materials = reinterpret_cast<const scene_file_material *>(base + header.materials);
+    const scene_file_texture *textures = reinterpret_cast<const scene_file_texture *>(base + header.textures);
+    const scene_file_ref *references = reinterpret_cast<const scene_file_ref *>(base + header.references);
+    const scene_file_group *groups = reinterpret_cast<const scene_file_group *>(base + header.groups);
+
+    // textures : views in the mapping
+    storage->images.reserve(header.texture_count);
+    for(uint32_t t = 0; t < header.texture_count; ++t){
+        const scene_file_texture& tex = textures[t];
+        bool ok = tex.width > 0 && tex.height > 0 && tex.levels == uint32_t(mip_count(tex.width, tex.height));
+        std::vector<mip_level> levels;
+        uint64_t offset = tex.texels;
+        for(int l = 0, w = tex.width, h = tex.height; ok && l < int(tex.levels); ++l, w = mip_size(w), h = mip_size(h)){
+            ok = fits(offset, mip_level::floats(w, h), sizeof(float));
+            mip_level level = { w, h, (w + texture_tile - 1) / texture_tile, (h + texture_tile - 1) / texture_tile,
+                reinterpret_cast<const float *>(base + offset) };
+            levels.push_back(level);
+            offset = align64(offset + mip_level::floats(w, h) * sizeof(float));
+        }
+        if(!ok)
+        {
+            std::cerr << "[error] scene file " << filename << " : texture " << t << std::endl;
+            return false;
+        }
+        storage->images.emplace_back(levels);
+    }
+
+    // materials, the arrays are reserved so the pointers stay valid
+    uint32_t counts[5] = {0, 0, 0, 0, 0};
+    for(uint32_t m = 0; m < header.material_count; ++m){
+        if(materials[m].type < scene_lambertian || materials[m].type > scene_diffuse_light
+            || materials[m].texture >= int32_t(header.texture_count))
+        {
+            std::cerr << "[error] scene file " << filename << " : material " << m << std::endl;
+            return false;
+        }
+        counts[materials[m].type]++;
+    }
+    storage->colors.reserve(header.material_count);
+    storage->lambertians.reserve(counts[scene_lambertian]);
+    storage->metals.reserve(counts[scene_metal]);
+    storage->dielectrics.reserve(counts[scene_dielectric]);
+    storage->lights.reserve(counts[scene_diffuse_light]);
+
+    std::vector<shared_ptr<material>> material_list(header.material_count);
+    for(uint32_t m = 0; m < header.material_count; ++m){
+        const scene_file_material& record = materials[m];
+        color c(record.color[0], record.color[1], record.color[2]);
+        shared_ptr<texture> tex;
+        if(record.texture >= 0)
+            tex = borrow<texture>(&storage->images[record.texture]);
+        else {
+            storage->colors.emplace_back(c);
+            tex = borrow<texture>(&storage->colors.back());
+        }
+
+        if(record.type == scene_lambertian){
+            storage->lambertians.emplace_back(tex);
+            material_list[m] = borrow<material>(&storage->lambertians.back());
+        } else if(record.type == scene_metal){
+            storage->metals.emplace_back(c, record.parameter);
+            material_list[m] = borrow<material>(&storage->metals.back());
+        } else if(record.type == scene_dielectric){
+            storage->dielectrics.emplace_back(record.parameter);
+            material_list[m] = borrow<material>(&storage->dielectrics.back());
+        } else {
+            storage->lights.emplace_back(tex);
+            material_list[m] = borrow<material>(&storage->lights.back());
+        }
+    }
+    auto material_at = [&](int32_t m){
+        return (m >= 0 && m < int32_t(material_list.size())) ? material_list[m] : nullptr;
+    };
+
+    // geometry
+    storage->triangles.resize(header.triangle_count);
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < int(header.triangle_count); ++i){
+        const scene_file_triangle& t = triangles[i];
+        storage->triangles[i] = triangle(point3(t.a[0], t.a[1], t.a[2]), point3(t.b[0], t.b[1], t.b[2]),
+            point3(t.c[0], t.c[1], t.c[2]), material_at(t.material));
+    }
+    storage->spheres.resize(header.sphere_count);
+    for(uint32_t i = 0; i < header.sphere_count; ++i){
+        const scene_file_sphere& s = spheres[i];
+        storage->spheres[i] = sphere(point3(s.center[0], s.center[1], s.center[2]), s.radius, material_at(s.material));
+    }
+
+    // bvh of each group, then the world and the lights
+    std::vector<shared_ptr<hittable>> nodes(header.group_count);
+    auto object = [&](const scene_file_ref& ref) -> shared_ptr<hittable> {
+        if(ref.type == scene_ref_triangle && ref.index < header.triangle_count)
+            return shared_ptr<hittable>(storage, &storage->triangles[ref.index]);
+        if(ref.type == scene_ref_sphere && ref.index < header.sphere_count)
+            return shared_ptr<hittable>(storage, &storage->spheres[ref.index]);
+        if(ref.type == scene_ref_bvh && ref.index < header.group_count)
+            return nodes[ref.index];
+        return nullptr;
+    };
+    for(uint32_t g = 0; g < header.group_count; ++g){
+        hittable_list members;
+        if(groups[g].first > header.reference_count || groups[g].count > header.reference_count - groups[g].first)
+            valid = false;
+        for(uint32_t r = 0; valid && r < groups[g].count; ++r){
+            const scene_file_ref& ref = references[groups[g].first + r];
+            shared_ptr<hittable> o = ref.type == scene_ref_bvh ? nullptr : object(ref);
+            if(o == nullptr) valid = false;
+            else members.add(o);
+        }
+        if(!valid || members.objects.empty())
+        {
+            std::cerr << "[error] scene file " << filename << " : group " << g << std::endl;
+            return false;
+        }
+        nodes[g] = scene_new<bvh_node>(members, 0, 1);
+    }
+
+    hittable_list objects;
+    std::vector<shared_ptr<hittable>> light_list;
+    for(uint32_t r = 0; r < header.world_count + header.light_count; ++r){
+        shared_ptr<hittable> o = object(references[r]);
+        if(o == nullptr)
+        {
+            std::cerr << "[error] scene file " << filename << " : reference " << r << std::endl;
+            return false;
+        }
+        if(r < header.world_count) objects.add(o);
+        else light_list.push_back(o);
+    }
+
+    world = objects;
+    lights = light_list;
+    background = color(header.background[0], header.background[1], header.background[2]);
+    cam = camera(point3(header.lookfrom[0], header.lookfrom[1], header.lookfrom[2]),
+        point3(header.lookat[0], header.lookat[1], header.lookat[2]),
+        vec3(header.vup[0], header.vup[1], header.vup[2]),
+        header.vfov, aspect_ratio, header.aperture, header.focus_dist);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "\nscene file " << filename << " loaded in " << seconds * 1000 << " ms : " << header.triangle_count
+              << " triangles, " << header.sphere_count << " spheres, " << header.texture_count << " textures" << std::endl;
+    return true;
+}
+
+#endif
@@ -0,0 +1,551 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "utility.hpp"
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "ioutility.hpp"
+#include "progressive.hpp"
+#include "render.hpp"
+
+// Render server : scenes are loaded once and kept with their BVH, render jobs are read
+// as JSON lines from stdin or from the clients of a Unix socket, queued by priority and
+// rendered one after the other on the OpenMP threads. Progress is streamed back as JSON
+// lines on the channel the job came from.
+//
+//   {"cmd": "render", "id": 1, "scene": "cornell_empty", "width": 400, "height": 300,
+//    "spp": 64, "depth": 50, "time": 0, "noise": 0, "priority": 0, "output": "job1",
+//    "camera": {"lookfrom": [0,1,3.5], "lookat": [0,1,0], "vfov": 40, "aperture": 0}}
+//   {"cmd": "load", "scene": "cornell"}      load a scene ahead of its jobs
+//   {"cmd": "load", "scene": "bigguy", "bvh": 8}   with 8 or 16 bit BVH nodes
+//   {"cmd": "unload", "scene": "cornell"}
+//   {"cmd": "status"}
+//   {"cmd": "quit"}                          stop once the queue is empty
+//
+// Each bvh layout of a scene is a scene of its own in the cache. A render or load without
+// "bvh" uses a layout of the scene already loaded, else the one of --bvh.
+
+// Minimal JSON value : enough for the flat requests above.
+struct json_value {
+    enum kind_type { null_value, number_value, string_value, bool_value, array_value, object_value };
+    kind_type kind = null_value;
+    double number = 0;
+    std::string text;
+    std::vector<json_value> array;
+    std::map<std::string, json_value> object;
+
+    bool has(const std::string& key) const { return object.count(key) > 0; }
+
+    double get_number(const std::string& key, double fallback) const {
+        auto it = object.find(key);
+        return (it != object.end() && it->second.kind == number_value) ? it->second.number : fallback;
+    }
+
+    std::string get_string(const std::string& key, const std::string& fallback) const {
+        auto it = object.find(key);
+        return (it != object.end() && it->second.kind == string_value) ? it->second.text : fallback;
+    }
+
+    bool get_vec3(const std::string& key, vec3& v) const {
+        auto it = object.find(key);
+        if(it == object.end() || it->second.array.size() != 3)
+            return false;
+        v = vec3(it->second.array[0].number, it->second.array[1].number, it->second.array[2].number);
+        return true;
+    }
+};
+
+class json_parser {
+    public:
+        json_parser(const std::string& text) : s(text), pos(0) {}
+
+        bool parse(json_value& value) {
+            return parse_value(value) && (skip(), pos == s.size());
+        }
+
+    private:
+        void skip() {
+            while(pos < s.size() && isspace((unsigned char) s[pos])) pos++;
+        }
+
+        bool parse_value(json_value& v) {
+            skip();
+            if(pos >= s.size()) return false;
+            char c = s[pos];
+            if(c == '{') return parse_object(v);
+            if(c == '[') return parse_array(v);
+            if(c == '"') { v.kind = json_value::string_value; return parse_string(v.text); }
+            if(s.compare(pos, 4, "true") == 0) { v.kind = json_value::bool_value; v.number = 1; pos += 4; return true; }
+            if(s.compare(pos, 5, "false") == 0) { v.kind = json_value::bool_value; v.number = 0; pos += 5; return true; }
+            if(s.compare(pos, 4, "null") == 0) { v.kind = json_value::null_value; pos += 4; return true; }
+            char *end = nullptr;
+            v.number = strtod(s.c_str() + pos, &end);
+            if(end == s.c_str() + pos) return false;
+            v.kind = json_value::number_value;
+            pos = end - s.c_str();
+            return true;
+        }
+
+        bool parse_string(std::string& out) {
+            pos++;  // "
+            while(pos < s.size() && s[pos] != '"'){
+                if(s[pos] == '\\' && pos + 1 < s.size()){
+                    pos++;
+                    char e = s[pos];
+                    out += (e == 'n') ? '\n' : (e == 't') ? '\t' : e;
+                } else {
+                    out += s[pos];
+                }
+                pos++;
+            }
+            if(pos >= s.size()) return false;
+            pos++;
+            return true;
+        }
+
+        bool parse_array(json_value& v) {
+            v.kind = json_value::array_value;
+            pos++;
+            skip();
+            if(pos < s.size() && s[pos] == ']') { pos++; return true; }
+            for(;;){
+                v.array.emplace_back();
+                if(!parse_value(v.array.back())) return false;
+                skip();
+                if(pos < s.size() && s[pos] == ',') { pos++; continue; }
+                if(pos < s.size() && s[pos] == ']') { pos++; return true; }
+                return false;
+            }
+        }
+
+        bool parse_object(json_value& v) {
+            v.kind = json_value::object_value;
+            pos++;
+            skip();
+            if(pos < s.size() && s[pos] == '}') { pos++; return true; }
+            for(;;){
+                skip();
+                std::string key;
+                if(pos >= s.size() || s[pos] != '"' || !parse_string(key)) return false;
+                skip();
+                if(pos >= s.size() || s[pos] != ':') return false;
+                pos++;
+                if(!parse_value(v.object[key])) return false;
+                skip();
+                if(pos < s.size() && s[pos] == ',') { pos++; continue; }
+                if(pos < s.size() && s[pos] == '}') { pos++; return true; }
+                return false;
+            }
+        }
+
+    private:
+        const std::string& s;
+        size_t pos;
+};
+
+std::string json_escape(const std::string& text)
+{
+    std::string out;
+    for(char c : text){
+        if(c == '"' || c == '\\') out += '\\';
+        if(c == '\n') { out += "\\n"; continue; }
+        out += c;
+    }
+    return out;
+}
+
+// Where the answers of a client go : stdout, or a socket connection.
+class reply_channel {
+    public:
+        reply_channel(int descriptor, bool is_socket) : fd(descriptor), socket(is_socket), open(true) {}
+
+        // a socket closes once its reader and all its queued jobs are done with it
+        ~reply_channel() {
+            close(fd);
+        }
+
+        void send(const std::string& line) {
+            std::lock_guard<std::mutex> guard(lock);
+            if(!open) return;
+            std::string l = line + "\n";
+            const char *p = l.c_str();
+            size_t size = l.size();
+            while(size > 0){
+                ssize_t n = socket ? ::send(fd, p, size, MSG_NOSIGNAL) : write(fd, p, size);
+                if(n <= 0) { open = false; return; }
+                p += n;
+                size -= n;
+            }
+        }
+
+        // wakes up the reader blocked on the connection, at the end of the server
+        void shutdown_socket() {
+            if(socket) ::shutdown(fd, SHUT_RDWR);
+        }
+
+    private:
+        int fd;
+        bool socket;
+        bool open;
+        std::mutex lock;
+};
+
+struct render_job {
+    long id;
+    int priority;
+    unsigned long sequence;
+    std::string scene_name;
+    bvh_layout layout;
+    std::string output;
+    int width, height;
+    int spp, depth;
+    double time_budget, noise_target;
+    json_value camera_override;
+    shared_ptr<reply_channel> reply;
+
+    // highest priority first, then first come first served
+    bool operator<(const render_job& other) const {
+        if(priority != other.priority) return priority < other.priority;
+        return sequence > other.sequence;
+    }
+};
+
+class render_server {
+    public:
+        render_server() : sequence(0), stopping(false), done(false) {}
+
+        // Scene with this bvh layout from the cache, loaded on first use. The load runs
+        // outside the lock : a null entry marks it, the other requests for the same scene
+        // and layout wait for it, the rest of the server goes on.
+        shared_ptr<scene> get_scene(const std::string& name, double& load_seconds, const bvh_layout layout) {
+            const scene_key key(name, layout);
+            std::unique_lock<std::mutex> guard(scenes_lock);
+            load_seconds = 0;
+            scenes_changed.wait(guard, [&]{ auto it = scenes.find(key); return it == scenes.end() || it->second; });
+            auto it = scenes.find(key);
+            if(it != scenes.end())
+                return it->second;
+            scenes[key] = nullptr;
+            guard.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+            auto sc = make_shared<scene>();
+            bool ok = load_scene(name, *sc, 4.0 / 3.0, 800, layout);
+            load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            guard.lock();
+            // unloaded meanwhile : the job gets the scene, the cache does not keep it
+            it = scenes.find(key);
+            if(it != scenes.end()){
+                if(ok) it->second = sc;
+                else scenes.erase(it);
+            }
+            guard.unlock();
+            scenes_changed.notify_all();
+            return ok ? sc : nullptr;
+        }
+
+        // "bvh" of the request, else a layout of the scene already loaded, else the default
+        bvh_layout request_layout(const json_value& request, const std::string& name) {
+            if(request.has("bvh")){
+                int bits = int(request.get_number("bvh", 0));
+                return bits == 8 ? bvh_quantized8 : bits == 16 ? bvh_quantized16 : bvh_pointers;
+            }
+            std::lock_guard<std::mutex> guard(scenes_lock);
+            auto it = scenes.lower_bound(scene_key(name, bvh_pointers));
+            return it != scenes.end() && it->first.first == name ? it->first.second : scene_bvh_layout();
+        }
+
+        void unload_scene(const std::string& name) {
+            std::lock_guard<std::mutex> guard(scenes_lock);
+            // every layout, and the loads in progress
+            auto it = scenes.lower_bound(scene_key(name, bvh_pointers));
+            while(it != scenes.end() && it->first.first == name)
+                it = scenes.erase(it);
+            // images of the scene are kept for the next load, up to the cache cap
+            texture_cache::instance().trim();
+        }
+
+        // Handle one request line, answers go to reply.
+        void handle(const std::string& line, shared_ptr<reply_channel> reply) {
+            if(line.find_first_not_of(" \t\r") == std::string::npos)
+                return;
+            json_value request;
+            json_parser parser(line);
+            if(!parser.parse(request) || request.kind != json_value::object_value){
+                reply->send("{\"status\": \"error\", \"message\": \"invalid json\"}");
+                return;
+            }
+
+            std::string cmd = request.get_string("cmd", "render");
+            if(cmd == "render")
+                submit(request, reply);
+            else if(cmd == "load"){
+                double seconds;
+                std::string name = request.get_string("scene", "");
+                bool ok = get_scene(name, seconds, request_layout(request, name)) != nullptr;
+                char buffer[256];
+                snprintf(buffer, sizeof(buffer), "{\"status\": \"%s\", \"scene\": \"%s\", \"load_ms\": %.1f}",
+                    ok ? "loaded" : "error", json_escape(name).c_str(), seconds * 1000);
+                reply->send(buffer);
+            }
+            else if(cmd == "unload"){
+                unload_scene(request.get_string("scene", ""));
+                reply->send("{\"status\": \"unloaded\"}");
+            }
+            else if(cmd == "status"){
+                std::lock_guard<std::mutex> guard(queue_lock);
+                std::lock_guard<std::mutex> guard_scenes(scenes_lock);
+                std::string s = "{\"status\": \"ok\", \"queued\": " + std::to_string(jobs.size()) + ", \"scenes\": [";
+                bool first = true;
+                for(auto& entry : scenes){
+                    if(!entry.second)
+                        continue;
+                    s += (first ? "\"" : ", \"") + json_escape(entry.first.first);
+                    s += entry.first.second != bvh_pointers ? " (bvh " + std::to_string(entry.first.second) + ")\"" : "\"";
+                    first = false;
+                }
+                reply->send(s + "]}");
+            }
+            else if(cmd == "quit"){
+                stop();
+                reply->send("{\"status\": \"stopping\"}");
+            }
+            else
+                reply->send("{\"status\": \"error\", \"message\": \"unknown command\"}");
+        }
+
+        void submit(const json_value& request, shared_ptr<reply_channel> reply) {
+            render_job job;
+            job.id = (long) request.get_number("id", 0);
+            job.priority = (int) request.get_number("priority", 0);
+            job.scene_name = request.get_string("scene", "cornell_empty");
+            job.layout = request_layout(request, job.scene_name);
+            job.width = std::max(1, (int) request.get_number("width", 800));
+            job.height = std::max(1, (int) request.get_number("height", job.width * 3 / 4));
+            job.spp = std::max(1, (int) request.get_number("spp", 16));
+            job.depth = (int) request.get_number("depth", 50);
+            job.time_budget = request.get_number("time", 0);
+            job.noise_target = request.get_number("noise", 0);
+            job.output = request.get_string("output", "job" + std::to_string(job.id));
+            if(request.has("camera"))
+                job.camera_override = request.object.at("camera");
+            job.reply = reply;
+            if((job.time_budget > 0 || job.noise_target > 0) && !request.has("spp"))
+                job.spp = INT_MAX;
+
+            {
+                std::lock_guard<std::mutex> guard(queue_lock);
+                job.sequence = sequence++;
+                jobs.push(job);
+            }
+            reply->send("{\"id\": " + std::to_string(job.id) + ", \"status\": \"queued\"}");
+            queue_changed.notify_one();
+        }
+
+        // Finish the queued jobs then return from run().
+        void stop() {
+            stopping = true;
+            queue_changed.notify_all();
+        }
+
+        // true once stopped with an empty queue
+        bool finished() const { return done; }
+
+        // Render the queued jobs until stop().
+        void run() {
+            for(;;){
+                render_job job;
+                {
+                    std::unique_lock<std::mutex> guard(queue_lock);
+                    queue_changed.wait(guard, [this]{ return stopping || !jobs.empty(); });
+                    if(jobs.empty()){
+                        done = true;
+                        return;
+                    }
+                    job = jobs.top();
+                    jobs.pop();
+                }
+                render(job);
+            }
+        }
+
+    private:
+        void render(render_job& job) {
+            auto start = std::chrono::steady_clock::now();
+            std::string id = "{\"id\": " + std::to_string(job.id);
+
+            double load_seconds;
+            shared_ptr<scene> sc = get_scene(job.scene_name, load_seconds, job.layout);
+            if(!sc){
+                job.reply->send(id + ", \"status\": \"error\", \"message\": \"unknown scene\"}");
+                return;
+            }
+
+            // camera of the scene, adapted to the job
+            const camera& c = sc->cam;
+            double aspect_ratio = double(job.width) / job.height;
+            point3 lookfrom = c.lookfrom, lookat = c.lookat;
+            const json_value& o = job.camera_override;
+            o.get_vec3("lookfrom", lookfrom);
+            o.get_vec3("lookat", lookat);
+            double focus = o.has("lookfrom") || o.has("lookat") ? (lookfrom - lookat).length() : c.focus_dist;
+            camera cam(lookfrom, lookat, c.vup, o.get_number("vfov", c.vfov), aspect_ratio,
+                o.get_number("aperture", c.aperture), o.get_number("focus", focus));
+
+            framebuffer fb(job.width, job.height);
+            progressive_control progress(job.time_budget, job.noise_target, 0);
+            double setup_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            char buffer[256];
+            snprintf(buffer, sizeof(buffer), ", \"status\": \"rendering\", \"setup_ms\": %.3f, \"load_ms\": %.1f}",
+                setup_seconds * 1000, load_seconds * 1000);
+            job.reply->send(id + buffer);
+
+            double last_report = 0;
+            for(int s = 0; s < job.spp; ++s){
+                render_pass(cam, sc->world, sc->background, fb, job.depth, (unsigned int) job.id, s);
+                progress.record(s + 1, (job.noise_target > 0) ? estimate_relative_error(fb) : infinity);
+                if(progress.elapsed() - last_report > 0.5){
+                    last_report = progress.elapsed();
+                    snprintf(buffer, sizeof(buffer), ", \"status\": \"progress\", \"samples\": %d, \"seconds\": %.3f}",
+                        s + 1, last_report);
+                    job.reply->send(id + buffer);
+                }
+                if(progress.should_stop())
+                    break;
+            }
+
+            write_image(fb, job.output);
+            snprintf(buffer, sizeof(buffer), ", \"status\": \"done\", \"samples\": %u, \"seconds\": %.3f, \"output\": \"%s\"}",
+                fb.min_samples(), progress.elapsed(), json_escape(job.output).c_str());
+            job.reply->send(id + buffer);
+        }
+
+    private:
+        typedef std::pair<std::string, bvh_layout> scene_key;
+
+        std::mutex scenes_lock;
+        std::condition_variable scenes_changed;
+        std::map<scene_key, shared_ptr<scene>> scenes;     // null while loading
+
+        std::mutex queue_lock;
+        std::condition_variable queue_changed;
+        std::priority_queue<render_job> jobs;
+        unsigned long sequence;
+        std::atomic<bool> stopping;
+        std::atomic<bool> done;
+};
+
+// Read request lines from fd until it closes.
+void read_requests(render_server& server, int fd, shared_ptr<reply_channel> reply)
+{
+    std::string pending;
+    char buffer[4096];
+    for(;;){
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if(n <= 0)
+            break;
+        pending.append(buffer, n);
+        size_t eol;
+        while((eol = pending.find('\n')) != std::string::npos){
+            server.handle(pending.substr(0, eol), reply);
+            pending.erase(0, eol + 1);
+        }
+    }
+    if(!pending.empty())
+        server.handle(pending, reply);
+}
+
+// Serve requests from stdin (path "-") or from a Unix socket at path.
+int run_server(const std::string& path)
+{
+    render_server server;
+    std::thread renderer(&render_server::run, &server);
+
+    if(path == "-"){
+        std::cerr << "render server reading requests on stdin" << std::endl;
+        // the loaders print on stdout : keep stdout for the answers only
+        int answers = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        read_requests(server, STDIN_FILENO, make_shared<reply_channel>(answers, false));
+        server.stop();
+        renderer.join();
+        return 0;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(path.c_str());
+    if(listener < 0 || bind(listener, (sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 16) < 0)
+    {
+        std::cerr << "[error] server can not listen on " << path << std::endl;
+        server.stop();
+        renderer.join();
+        return -1;
+    }
+    std::cerr << "render server listening on " << path << std::endl;
+
+    // one reader thread per client, until a client sends quit. The readers use the server :
+    // they are joined before it is destroyed, the ones still connected woken up by a shutdown
+    // of their socket.
+    struct client {
+        shared_ptr<reply_channel> reply;
+        std::atomic<bool> done{false};
+        std::thread reader;
+    };
+    std::list<client> clients;
+    while(!server.finished())
+    {
+        pollfd p = {listener, POLLIN, 0};
+        if(poll(&p, 1, 200) > 0 && (p.revents & POLLIN)){
+            int fd = accept(listener, nullptr, nullptr);
+            if(fd >= 0){
+                clients.emplace_back();
+                client& c = clients.back();
+                c.reply = make_shared<reply_channel>(fd, true);
+                c.reader = std::thread([&server, &c, fd]{
+                    read_requests(server, fd, c.reply);
+                    c.done = true;
+                });
+            }
+        }
+        for(auto it = clients.begin(); it != clients.end(); ){
+            if(it->done){
+                it->reader.join();
+                it = clients.erase(it);
+            } else
+                ++it;
+        }
+    }
+    close(listener);
+    unlink(path.c_str());
+    for(client& c : clients)
+        c.reply->shutdown_socket();
+    for(client& c : clients)
+        c.reader.join();
+    renderer.join();
+    return 0;
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// Render statistics, compiled with -DRT_STATS (cmake -DRT_STATS=ON) : rays by type and
+// bounce, hits and misses, BVH nodes visited, primitive tests, scatter calls by material
+// and texture fetches by texture.
+//
+// Every thread counts in its own block (aligned on a cache line, no atomics, no sharing),
+// the blocks are summed by write_render_stats() at the end of the render. Without
+// RT_STATS, RT_STAT(...) expands to nothing and write_render_stats() does nothing.
+//
+//   RT_STAT(nodes++);
+//   RT_STAT(scatters[stat_metal]++);
+
+enum stat_ray_type { stat_camera, stat_bounce, stat_shadow, stat_ray_types };
+enum stat_primitive { stat_triangle, stat_sphere, stat_primitives };
+enum stat_material { stat_lambertian, stat_metal, stat_dielectric, stat_diffuse_light, stat_materials };
+enum stat_texture { stat_solid, stat_checker, stat_noise, stat_image, stat_textures };
+
+const int stat_bounces = 16;    // the last one counts the deeper bounces too
+
+struct alignas(64) render_counters {
+    uint64_t rays[stat_ray_types][stat_bounces];
+    uint64_t hits[stat_ray_types];
+    uint64_t misses[stat_ray_types];
+    uint64_t nodes;
+    uint64_t tests[stat_primitives];
+    uint64_t scatters[stat_materials];
+    uint64_t fetches[stat_textures];
+    int bounce;                 // of the current path
+
+    // a ray of the path : camera rays start it, the bounces follow
+    void ray(stat_ray_type type) {
+        if (type == stat_camera)
+            bounce = 0;
+        else if (type == stat_bounce)
+            bounce++;
+        rays[type][bounce < stat_bounces ? bounce : stat_bounces - 1]++;
+    }
+
+    void traced(stat_ray_type type, bool hit) {
+        if (hit) hits[type]++;
+        else misses[type]++;
+    }
+
+    void add(const render_counters& c) {
+        for (int t = 0; t < stat_ray_types; ++t) {
+            for (int b = 0; b < stat_bounces; ++b)
+                rays[t][b] += c.rays[t][b];
+            hits[t] += c.hits[t];
+            misses[t] += c.misses[t];
+        }
+        nodes += c.nodes;
+        for (int p = 0; p < stat_primitives; ++p) tests[p] += c.tests[p];
+        for (int m = 0; m < stat_materials; ++m) scatters[m] += c.scatters[m];
+        for (int t = 0; t < stat_textures; ++t) fetches[t] += c.fetches[t];
+    }
+};
+
+#ifdef RT_STATS
+
+// Blocks of the running threads, and the sum of the finished ones.
+class render_stats {
+    public:
+        static render_stats& instance() {
+            static render_stats stats;
+            return stats;
+        }
+
+        void enter(render_counters *c) {
+            std::lock_guard<std::mutex> guard(lock);
+            threads.push_back(c);
+        }
+
+        void leave(render_counters *c) {
+            std::lock_guard<std::mutex> guard(lock);
+            retired.add(*c);
+            for (size_t i = 0; i < threads.size(); ++i) {
+                if (threads[i] == c) {
+                    threads[i] = threads.back();
+                    threads.pop_back();
+                    break;
+                }
+            }
+        }
+
+        // read while the threads are idle, after the render
+        render_counters total() {
+            std::lock_guard<std::mutex> guard(lock);
+            render_counters sum = retired;
+            for (const render_counters *c : threads)
+                sum.add(*c);
+            return sum;
+        }
+
+    private:
+        render_stats() { memset(&retired, 0, sizeof(retired)); }
+
+        std::mutex lock;
+        std::vector<render_counters *> threads;
+        render_counters retired;
+};
+
+struct render_counters_slot {
+    render_counters counters;
+    render_counters_slot() {
+        memset(&counters, 0, sizeof(counters));
+        render_stats::instance().enter(&counters);
+    }
+    ~render_counters_slot() { render_stats::instance().leave(&counters); }
+};
+
+inline render_counters& thread_stats() {
+    static thread_local render_counters_slot slot;
+    return slot.counters;
+}
+
+#define RT_STAT(expr) (thread_stats().expr)
+
+#else
+
+#define RT_STAT(expr) ((void)0)
+
+#endif
+
+// Traversal of a single ray, for the heatmaps (heatmap.hpp), compiled with -DRT_HEATMAPS
+// (cmake -DRT_HEATMAPS=ON) : the probe only counts while it is set on the thread. Without
+// RT_HEATMAPS, active_probe() is a constant nullptr and the traversals test nothing.
+//
+//   traversal_probe probe;
+//   set_active_probe(&probe);
+//   world.hit(r, 0.001, infinity, rec);
+//   set_active_probe(nullptr);
+struct traversal_probe {
+    uint32_t nodes = 0;         // bvh nodes visited
+    uint32_t tests = 0;         // primitive tests
+    int level = 0;              // bvh nodes above the object being tested
+    int hit_depth = -1;         // level of the closest hit, -1 without hit
+
+    void hit() { hit_depth = level; }
+};
+
+#ifdef RT_HEATMAPS
+
+inline traversal_probe*& thread_probe() {
+    static thread_local traversal_probe *probe = nullptr;
+    return probe;
+}
+
+inline traversal_probe* active_probe() { return thread_probe(); }
+inline void set_active_probe(traversal_probe *probe) { thread_probe() = probe; }
+
+#else
+
+inline traversal_probe* active_probe() { return nullptr; }
+inline void set_active_probe(traversal_probe *) {}
+
+#endif
+
+// Summary table on stderr and the counters in filename (JSON).
+#ifdef RT_STATS
+bool write_render_stats(const char *filename)
+{
+    const char *ray_names[stat_ray_types] = {"camera", "bounce", "shadow"};
+    const char *primitive_names[stat_primitives] = {"triangle", "sphere"};
+    const char *material_names[stat_materials] = {"lambertian", "metal", "dielectric", "diffuse_light"};
+    const char *texture_names[stat_textures] = {"solid", "checker", "noise", "image"};
+    render_counters c = render_stats::instance().total();
+
+    uint64_t traced = 0;
+    int bounces = 1;
+    for (int t = 0; t < stat_ray_types; ++t) {
+        for (int b = 0; b < stat_bounces; ++b) {
+            traced += c.rays[t][b];
+            if (c.rays[t][b] > 0)
+                bounces = std::max(bounces, b + 1);
+        }
+    }
+    double per_ray = traced > 0 ? 1.0 / traced : 0;
+
+    std::cerr << "render statistics :" << std::endl;
+    char line[256];
+    snprintf(line, sizeof(line), "  %-8s %14s %14s %14s   by bounce", "rays", "total", "hits", "misses");
+    std::cerr << line << std::endl;
+    for (int t = 0; t < stat_ray_types; ++t) {
+        uint64_t total = 0;
+        for (int b = 0; b < stat_bounces; ++b)
+            total += c.rays[t][b];
+        snprintf(line, sizeof(line), "  %-8s %14llu %14llu %14llu  ", ray_names[t], (unsigned long long) total,
+            (unsigned long long) c.hits[t], (unsigned long long) c.misses[t]);
+        std::cerr << line;
+        for (int b = 0; b < bounces; ++b)
+            std::cerr << " " << c.rays[t][b];
+        std::cerr << std::endl;
+    }
+    std::cerr << "  bvh nodes visited : " << c.nodes << " (" << c.nodes * per_ray << " per ray)" << std::endl;
+    std::cerr << "  primitive tests   :";
+    for (int p = 0; p < stat_primitives; ++p)
+        std::cerr << " " << primitive_names[p] << " " << c.tests[p] << " (" << c.tests[p] * per_ray << " per ray)";
+    std::cerr << std::endl << "  scatter calls     :";
+    for (int m = 0; m < stat_materials; ++m)
+        std::cerr << " " << material_names[m] << " " << c.scatters[m];
+    std::cerr << std::endl << "  texture fetches   :";
+    for (int t = 0; t < stat_textures; ++t)
+        std::cerr << " " << texture_names[t] << " " << c.fetches[t];
+    std::cerr << std::endl;
+
+    FILE *out = fopen(filename, "wt");
+    if (out == NULL)
+        return false;
+    fprintf(out, "{\n  \"rays\": {\n");
+    for (int t = 0; t < stat_ray_types; ++t) {
+        fprintf(out, "    \"%s\": {\"hits\": %llu, \"misses\": %llu, \"by_bounce\": [", ray_names[t],
+            (unsigned long long) c.hits[t], (unsigned long long) c.misses[t]);
+        for (int b = 0; b < bounces; ++b)
+            fprintf(out, "%s%llu", b > 0 ? ", " : "", (unsigned long long) c.rays[t][b]);
+        fprintf(out, "]}%s\n", t + 1 < stat_ray_types ? "," : "");
+    }
+    fprintf(out, "  },\n  \"bvh_nodes\": %llu,\n  \"primitive_tests\": {", (unsigned long long) c.nodes);
+    for (int p = 0; p < stat_primitives; ++p)
+        fprintf(out, "%s\"%s\": %llu", p > 0 ? ", " : "", primitive_names[p], (unsigned long long) c.tests[p]);
+    fprintf(out, "},\n  \"scatter_calls\": {");
+    for (int m = 0; m < stat_materials; ++m)
+        fprintf(out, "%s\"%s\": %llu", m > 0 ? ", " : "", material_names[m], (unsigned long long) c.scatters[m]);
+    fprintf(out, "},\n  \"texture_fetches\": {");
+    for (int t = 0; t < stat_textures; ++t)
+        fprintf(out, "%s\"%s\": %llu", t > 0 ? ", " : "", texture_names[t], (unsigned long long) c.fetches[t]);
+    fprintf(out, "}\n}\n");
+    return fclose(out) == 0;
+}
+#else
+inline bool write_render_stats(const char *filename) { return false; }
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+using std::shared_ptr;
+using std::make_shared;
+
+// Scene arena : the primitives, BVH nodes, materials and textures of a scene are built in
+// per-type pools, in large blocks, contiguous in build order, and destroyed all at once
+// with the arena (the scene owns it).
+//
+// The arena hands out non-owning shared_ptrs (aliasing an empty shared_ptr) : no control
+// block, no reference counting, the rest of the code is unchanged. They are valid as
+// long as the arena.
+//
+// The loaders allocate with scene_new<T>(...), from the arena of the scene being loaded
+// (arena_scope, set by load_scene on the loading thread), or with make_shared when no
+// arena is active. A type_arena_scope<T> sends the objects of type T to another arena :
+// the bvh_node trees that load_scene compresses are built in a scratch arena, released
+// once they are replaced.
+
+class scene_arena {
+    public:
+        static const size_t block_bytes = 1 << 20;
+
+        scene_arena() {}
+        scene_arena(const scene_arena&) = delete;
+        scene_arena& operator=(const scene_arena&) = delete;
+
+        ~scene_arena() {
+            // newest pools first, they may hold references to the older ones
+            for (auto it = order.rbegin(); it != order.rend(); ++it)
+                (*it)->release();
+        }
+
+        // Built outside the lock : constructors allocate too (bvh_node builds its children,
+        // lambertian its solid_color), a BVH is stored in depth first order.
+        template <class T, class... Args>
+        shared_ptr<T> make(Args&&... args) {
+            T *slot;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                slot = pool_of<T>().slots(1);
+            }
+            return handle(new (slot) T(std::forward<Args>(args)...));
+        }
+
+        // n objects in one contiguous range, object i built by make(i) (returns a T) on
+        // all threads, the handles in out.
+        template <class T, class Base, class F>
+        void make_array(size_t n, F make, std::vector<shared_ptr<Base>>& out) {
+            T *first;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                first = pool_of<T>().slots(n);
+            }
+            out.resize(n);
+            #pragma omp parallel for schedule(static)
+            for (long i = 0; i < long(n); ++i) {
+                new (first + i) T(make(i));
+                out[i] = handle<Base>(first + i);
+            }
+        }
+
+        template <class T>
+        static shared_ptr<T> handle(T *object) {
+            return shared_ptr<T>(shared_ptr<T>(), object);
+        }
+
+        void report() {
+            std::lock_guard<std::mutex> guard(lock);
+            size_t objects = 0, bytes = 0, blocks = 0;
+            for (pool_base *p : order) {
+                objects += p->objects;
+                bytes += p->bytes;
+                blocks += p->blocks.size();
+            }
+            std::cerr << "arena : " << objects << " objects, " << bytes / 1e6 << " MB in " << blocks
+                      << " blocks of " << pools.size() << " types" << std::endl;
+        }
+
+    private:
+        struct block {
+            void *memory;
+            size_t capacity, used;
+        };
+
+        struct pool_base {
+            virtual ~pool_base() {}
+            virtual void release() = 0;
+            std::vector<block> blocks;
+            size_t objects = 0;
+            size_t bytes = 0;
+        };
+
+        template <class T>
+        struct pool : public pool_base {
+            ~pool() { release(); }
+
+            // n contiguous slots, a new block if the last one is too small. The caller
+            // builds the objects right away, they are destroyed with the block.
+            // Blocks double from 16 objects up to block_bytes.
+            T *slots(size_t n) {
+                if (blocks.empty() || blocks.back().capacity - blocks.back().used < n) {
+                    size_t largest = std::max<size_t>(16, block_bytes / sizeof(T));
+                    size_t capacity = blocks.empty() ? 16 : std::min(2 * blocks.back().capacity, largest);
+                    capacity = std::max(n, capacity);
+                    void *memory = ::operator new(capacity * sizeof(T), std::align_val_t(alignof(T)));
+                    blocks.push_back({memory, capacity, 0});
+                    bytes += capacity * sizeof(T);
+                }
+                block& b = blocks.back();
+                T *first = static_cast<T *>(b.memory) + b.used;
+                b.used += n;
+                objects += n;
+                return first;
+            }
+
+            void release() override {
+                for (auto b = blocks.rbegin(); b != blocks.rend(); ++b) {
+                    T *first = static_cast<T *>(b->memory);
+                    for (size_t i = b->used; i > 0; --i)
+                        first[i-1].~T();
+                    ::operator delete(b->memory, std::align_val_t(alignof(T)));
+                }
+                blocks.clear();
+            }
+        };
+
+        template <class T>
+        pool<T>& pool_of() {
+            std::unique_ptr<pool_base>& p = pools[std::type_index(typeid(T))];
+            if (!p) {
+                p.reset(new pool<T>());
+                order.push_back(p.get());
+            }
+            return static_cast<pool<T>&>(*p);
+        }
+
+    private:
+        std::mutex lock;
+        std::map<std::type_index, std::unique_ptr<pool_base>> pools;
+        std::vector<pool_base *> order;     // creation order of the pools
+};
+
+inline scene_arena *& current_arena() {
+    static thread_local scene_arena *arena = nullptr;
+    return arena;
+}
+
+// Allocations of this thread go to arena until the end of the scope.
+class arena_scope {
+    public:
+        arena_scope(scene_arena& arena) : previous(current_arena()) { current_arena() = &arena; }
+        ~arena_scope() { current_arena() = previous; }
+
+    private:
+        scene_arena *previous;
+};
+
+// arena of the objects of type T on this thread, ahead of current_arena()
+template <class T>
+inline scene_arena *& type_arena() {
+    static thread_local scene_arena *arena = nullptr;
+    return arena;
+}
+
+// Allocations of T by this thread go to arena until the end of the scope, none : unchanged.
+template <class T>
+class type_arena_scope {
+    public:
+        type_arena_scope(scene_arena *arena) : previous(type_arena<T>()) {
+            if (arena) type_arena<T>() = arena;
+        }
+        ~type_arena_scope() { type_arena<T>() = previous; }
+
+    private:
+        scene_arena *previous;
+};
+
+template <class T, class... Args>
+shared_ptr<T> scene_new(Args&&... args) {
+    scene_arena *arena = type_arena<T>() ? type_arena<T>() : current_arena();
+    if (arena == nullptr)
+        return make_shared<T>(std::forward<Args>(args)...);
+    return arena->make<T>(std::forward<Args>(args)...);
+}
+
+#endif
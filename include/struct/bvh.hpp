@@ -4,14 +4,17 @@
 #include "algorithm"
 
 #include "../utility.hpp"
+#include "../stats.hpp"
+#include "../trace.hpp"
 
 #include "aabb.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
+#include "arena.hpp"
 
 class bvh_node : public hittable {
     public:
-        bvh_node();
+        bvh_node() {}
 
         bvh_node(const hittable_list& list, double time0, double time1)
             : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
@@ -21,6 +24,9 @@ class bvh_node : public hittable {
             const std::vector<shared_ptr<hittable>>& src_objects,
             size_t start, size_t end, double time0, double time1);
 
+        // node of objects[start, end[, sorted in place
+        void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, double time0, double time1);
+
         virtual point3 point( const float u, const float v ) const override;
 
         virtual bool hit(
@@ -45,11 +51,16 @@ bool bvh_node::bounding_box(double time0, double time1, aabb& output_box) const
 }
 
 bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT(nodes++);
+    traversal_probe *probe = active_probe();
+    if (probe) probe->nodes++;
     if (!box.hit(r, t_min, t_max))
         return false;
 
+    if (probe) probe->level++;
     bool hit_left = left->hit(r, t_min, t_max, rec);
     bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+    if (probe) probe->level--;
 
     return hit_left || hit_right;
 }
@@ -63,7 +74,7 @@ inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable>
 
     if (axis == 0)
         return box_a.min().x < box_b.min().x;
-    if (axis == 0)
+    if (axis == 1)
         return box_a.min().y < box_b.min().y;
     return box_a.min().z < box_b.min().z;
 }
@@ -84,8 +95,17 @@ bvh_node::bvh_node(
     const std::vector<shared_ptr<hittable>>& src_objects,
     size_t start, size_t end, double time0, double time1
 ) {
+    RT_TRACE("build_bvh");
     auto objects = src_objects; // Create a modifiable array of the source scene objects
+    build(objects, start, end, time0, time1);
+}
 
+// Every node sorts its own range and its children split it, so one copy of the objects
+// is enough : the same tree as with a copy per node, in linear memory.
+void bvh_node::build(
+    std::vector<shared_ptr<hittable>>& objects,
+    size_t start, size_t end, double time0, double time1
+) {
     aabb bounds;
     objects[start]->bounding_box(0,1, bounds);
     // construire la boite englobante des centres des primitives d'indices [begin .. end[
@@ -132,8 +152,12 @@ bvh_node::bvh_node(
         std::sort(objects.begin() + start, objects.begin() + end, comparator);
     
         auto mid = (start + end)/2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+        auto left_node = scene_new<bvh_node>();
+        left_node->build(objects, start, mid, time0, time1);
+        auto right_node = scene_new<bvh_node>();
+        right_node->build(objects, mid, end, time0, time1);
+        left = left_node;
+        right = right_node;
     }
 
     aabb box_left, box_right;
@@ -0,0 +1,325 @@
+#ifndef BVH_REPORT_H
+#define BVH_REPORT_H
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "bvh.hpp"
+#include "quantized_bvh.hpp"
+#include "paged_mesh.hpp"
+
+// Quality of the BVHs of a scene, after the build (--bvh-report file.json) :
+//
+//   sah_cost    : sum over the nodes of area(node) / area(root) * (traversal + primitives
+//                 of the node * intersection), the expected cost of a random ray
+//   overlap     : mean over the nodes with two children of area(left & right) / area(node),
+//                 and the same with the volumes
+//   empty_space : mean over the nodes of the share of their volume outside their children
+//   depths      : number of primitives at each depth (nodes above them)
+//   leaf_sizes  : number of nodes holding n primitives
+//   nodes, bytes
+//
+// Every layout is measured on the boxes its traversal tests : the decoded boxes of the
+// quantized nodes, the pages of a paged_mesh read through the page cache. Flat boxes (no
+// volume) are left out of the volume ratios.
+
+const double sah_traversal_cost = 1.0;
+const double sah_intersection_cost = 1.0;
+
+struct bvh_quality {
+    std::string type;
+    size_t object = 0;          // index in the world
+    bool nested = false;        // primitive of the BVH of the object
+    size_t nodes = 0;
+    size_t primitives = 0;
+    size_t bytes = 0;           // in memory, pages excluded
+    size_t page_bytes = 0;      // paged_mesh : size of the page file
+    double root_area = 0;
+    double sah_cost = 0;
+    double overlap_area = 0;    // sums of ratios, divided at the end
+    double overlap_volume = 0;
+    size_t overlap_nodes = 0;
+    size_t overlap_volume_nodes = 0;
+    double empty_space = 0;
+    size_t empty_nodes = 0;
+    std::vector<size_t> depths;
+    std::vector<size_t> leaf_sizes;
+
+    static double area(const box3& b) {
+        double d[3];
+        for (int a = 0; a < 3; ++a)
+            d[a] = std::max(0.0, b.max[a] - b.min[a]);
+        return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+
+    static double volume(const box3& b) {
+        double v = 1;
+        for (int a = 0; a < 3; ++a)
+            v *= std::max(0.0, b.max[a] - b.min[a]);
+        return v;
+    }
+
+    static box3 intersection(const box3& a, const box3& b) {
+        box3 i;
+        for (int k = 0; k < 3; ++k) {
+            i.min[k] = std::max(a.min[k], b.min[k]);
+            i.max[k] = std::min(a.max[k], b.max[k]);
+        }
+        return i;
+    }
+
+    static bool disjoint(const box3& b) {
+        return b.max[0] < b.min[0] || b.max[1] < b.min[1] || b.max[2] < b.min[2];
+    }
+
+    // a node at depth, count children (1 or 2, boxes in children, none for the leaves of
+    // a page) of which primitives are primitives. The root comes first.
+    void node(const box3& box, int depth, const box3 *children, int count, int primitives) {
+        if (nodes++ == 0)
+            root_area = area(box);
+        if (root_area > 0)
+            sah_cost += area(box) / root_area * (sah_traversal_cost + primitives * sah_intersection_cost);
+        if (primitives > 0) {
+            this->primitives += primitives;
+            if (depths.size() <= size_t(depth + 1))
+                depths.resize(depth + 2, 0);
+            depths[depth + 1] += primitives;
+            if (leaf_sizes.size() <= size_t(primitives))
+                leaf_sizes.resize(primitives + 1, 0);
+            leaf_sizes[primitives]++;
+        }
+        if (count == 0)
+            return;
+
+        double a = area(box), v = volume(box), shared = 0;
+        if (count == 2) {
+            box3 both = intersection(children[0], children[1]);
+            if (!disjoint(both)) {
+                shared = volume(both);
+                if (a > 0) overlap_area += area(both) / a;
+            }
+            if (a > 0) overlap_nodes++;
+            if (v > 0) {
+                overlap_volume += shared / v;
+                overlap_volume_nodes++;
+            }
+        }
+        if (v > 0) {
+            double covered = -shared;
+            for (int c = 0; c < count; ++c)
+                covered += volume(children[c]);
+            empty_space += std::max(0.0, 1 - covered / v);
+            empty_nodes++;
+        }
+    }
+
+    int max_depth() const { return depths.empty() ? 0 : int(depths.size()) - 1; }
+};
+
+box3 to_box3(const aabb& b)
+{
+    box3 box;
+    for (int a = 0; a < 3; ++a) {
+        box.min[a] = b.min()[a];
+        box.max[a] = b.max()[a];
+    }
+    return box;
+}
+
+box3 to_box3(const page_node& n)
+{
+    box3 box;
+    for (int a = 0; a < 3; ++a) {
+        box.min[a] = n.lo[a];
+        box.max[a] = n.hi[a];
+    }
+    return box;
+}
+
+void report_bvh_node(const bvh_node& n, int depth, bvh_quality& q)
+{
+    const shared_ptr<hittable> children[2] = { n.left, n.right };
+    const int count = n.left == n.right ? 1 : 2;
+    box3 boxes[2];
+    int primitives = 0;
+    for (int c = 0; c < count; ++c) {
+        aabb b;
+        children[c]->bounding_box(0, 1, b);
+        boxes[c] = to_box3(b);
+        if (!dynamic_cast<const bvh_node *>(children[c].get()))
+            primitives++;
+    }
+    q.node(to_box3(n.box), depth, boxes, count, primitives);
+    for (int c = 0; c < count; ++c)
+        if (auto inner = dynamic_cast<const bvh_node *>(children[c].get()))
+            report_bvh_node(*inner, depth + 1, q);
+}
+
+template <typename Q>
+void report_quantized(const quantized_bvh<Q>& tree, uint32_t index, const box3& box, int depth, bvh_quality& q)
+{
+    typedef quantized_node<Q> node;
+    const node& n = tree.nodes[index];
+    double step[3];
+    node::steps(box, step);
+    box3 boxes[2];
+    int count = 0, primitives = 0;
+    for (int c = 0; c < 2; ++c) {
+        if (n.child[c] == node::none)
+            continue;
+        boxes[count++] = n.box(box, step, c);
+        if (n.child[c] & node::leaf)
+            primitives++;
+    }
+    q.node(box, depth, boxes, count, primitives);
+    for (int c = 0, k = 0; c < 2; ++c) {
+        if (n.child[c] == node::none)
+            continue;
+        if (!(n.child[c] & node::leaf))
+            report_quantized(tree, n.child[c], boxes[k], depth + 1, q);
+        k++;
+    }
+}
+
+// a page : its tree replaces the leaf of the top tree
+void report_page(const page_node *local, uint32_t index, int depth, bvh_quality& q)
+{
+    const page_node& n = local[index];
+    if (n.count > 0) {
+        q.node(to_box3(n), depth, nullptr, 0, n.count);
+        return;
+    }
+    const box3 boxes[2] = { to_box3(local[index + 1]), to_box3(local[n.first]) };
+    q.node(to_box3(n), depth, boxes, 2, 0);
+    report_page(local, index + 1, depth + 1, q);
+    report_page(local, n.first, depth + 1, q);
+}
+
+void report_paged(const paged_mesh& mesh, uint32_t index, int depth, bvh_quality& q)
+{
+    const page_node& n = mesh.nodes[index];
+    if (n.count > 0) {
+        const char *page = mesh.file.page(n.first);
+        report_page(reinterpret_cast<const page_node *>(page + sizeof(page_header)), 0, depth, q);
+        return;
+    }
+    const box3 boxes[2] = { to_box3(mesh.nodes[index + 1]), to_box3(mesh.nodes[n.first]) };
+    q.node(to_box3(n), depth, boxes, 2, 0);
+    report_paged(mesh, index + 1, depth + 1, q);
+    report_paged(mesh, n.first, depth + 1, q);
+}
+
+bool is_bvh(const hittable *object)
+{
+    return dynamic_cast<const bvh_node *>(object) || quantized_primitives(object)
+        || dynamic_cast<const paged_mesh *>(object);
+}
+
+// BVHs among the primitives of a BVH (a paged_mesh is one primitive of the scene BVH)
+void nested_bvhs(const hittable *object, std::vector<const hittable *>& found)
+{
+    if (auto tree = dynamic_cast<const bvh_node *>(object)) {
+        for (const hittable *child : { tree->left.get(), tree->right.get() }) {
+            if (dynamic_cast<const bvh_node *>(child))
+                nested_bvhs(child, found);
+            else if (is_bvh(child) && std::find(found.begin(), found.end(), child) == found.end())
+                found.push_back(child);
+        }
+    } else if (auto primitives = quantized_primitives(object)) {
+        for (const auto& p : *primitives)
+            if (is_bvh(p.get()))
+                found.push_back(p.get());
+    }
+}
+
+bool analyze_bvh(const hittable *object, bvh_quality& q)
+{
+    if (auto tree = dynamic_cast<const bvh_node *>(object)) {
+        q.type = "pointers";
+        report_bvh_node(*tree, 0, q);
+        q.bytes = q.nodes * sizeof(bvh_node);
+    } else if (auto q8 = dynamic_cast<const quantized_bvh<uint8_t> *>(object)) {
+        q.type = "quantized8";
+        report_quantized(*q8, 0, q8->root, 0, q);
+        q.bytes = q8->bytes();
+    } else if (auto q16 = dynamic_cast<const quantized_bvh<uint16_t> *>(object)) {
+        q.type = "quantized16";
+        report_quantized(*q16, 0, q16->root, 0, q);
+        q.bytes = q16->bytes();
+    } else if (auto paged = dynamic_cast<const paged_mesh *>(object)) {
+        q.type = "paged";
+        report_paged(*paged, 0, 0, q);
+        q.bytes = paged->nodes.size() * sizeof(page_node) + paged->materials.size() * sizeof(shared_ptr<material>);
+        q.page_bytes = paged->file.bytes();
+    } else
+        return false;
+    return true;
+}
+
+// quality of every BVH among the objects of world, then of the BVHs nested in them
+std::vector<bvh_quality> analyze_bvhs(const hittable_list& world)
+{
+    std::vector<bvh_quality> reports;
+    for (size_t i = 0; i < world.objects.size(); ++i) {
+        std::vector<const hittable *> objects = { world.objects[i].get() };
+        for (size_t k = 0; k < objects.size(); ++k) {
+            bvh_quality q;
+            q.object = i;
+            q.nested = k > 0;
+            if (!analyze_bvh(objects[k], q))
+                continue;
+            reports.push_back(q);
+            nested_bvhs(objects[k], objects);
+        }
+    }
+    return reports;
+}
+
+void write_histogram(FILE *out, const std::vector<size_t>& values)
+{
+    fprintf(out, "[");
+    for (size_t i = 0; i < values.size(); ++i)
+        fprintf(out, "%s%zu", i > 0 ? ", " : "", values[i]);
+    fprintf(out, "]");
+}
+
+// A line per BVH on stderr and the report in filename (JSON).
+bool write_bvh_report(const hittable_list& world, const char *filename)
+{
+    std::vector<bvh_quality> reports = analyze_bvhs(world);
+    FILE *out = fopen(filename, "wt");
+    if (out == NULL) {
+        std::cerr << "[error] writing " << filename << std::endl;
+        return false;
+    }
+    fprintf(out, "{\n  \"sah_traversal_cost\": %g,\n  \"sah_intersection_cost\": %g,\n  \"bvhs\": [\n",
+        sah_traversal_cost, sah_intersection_cost);
+    for (size_t r = 0; r < reports.size(); ++r) {
+        const bvh_quality& q = reports[r];
+        double overlap_area = q.overlap_nodes > 0 ? q.overlap_area / q.overlap_nodes : 0;
+        double overlap_volume = q.overlap_volume_nodes > 0 ? q.overlap_volume / q.overlap_volume_nodes : 0;
+        double empty_space = q.empty_nodes > 0 ? q.empty_space / q.empty_nodes : 0;
+        std::cerr << "bvh " << q.object << (q.nested ? " nested" : "") << " (" << q.type << ") : " << q.primitives << " primitives, " << q.nodes
+                  << " nodes, " << q.bytes / 1e6 << " MB, sah " << q.sah_cost << ", depth " << q.max_depth()
+                  << ", overlap " << overlap_area << ", empty " << empty_space << std::endl;
+
+        fprintf(out, "    {\"object\": %zu, \"nested\": %s, \"type\": \"%s\", \"primitives\": %zu, \"nodes\": %zu, \"bytes\": %zu, \"page_bytes\": %zu,\n",
+            q.object, q.nested ? "true" : "false", q.type.c_str(), q.primitives, q.nodes, q.bytes, q.page_bytes);
+        fprintf(out, "     \"sah_cost\": %g, \"overlap\": {\"area_ratio\": %g, \"volume_ratio\": %g}, \"empty_space\": %g, \"max_depth\": %d,\n",
+            q.sah_cost, overlap_area, overlap_volume, empty_space, q.max_depth());
+        fprintf(out, "     \"depths\": ");
+        write_histogram(out, q.depths);
+        fprintf(out, ",\n     \"leaf_sizes\": ");
+        write_histogram(out, q.leaf_sizes);
+        fprintf(out, "}%s\n", r + 1 < reports.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+#endif
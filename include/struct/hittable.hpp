@@ -14,6 +14,8 @@ struct hit_record {
     bool front_face;
     double u;
     double v;
+    vec3 dpdu, dpdv;    // derivatives of p in u and v, set by the primitives
+    double footprint;   // width of the pixel in (u,v) at p, see uv_footprint
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
@@ -21,6 +23,33 @@ struct hit_record {
     }
 };
 
+// Width in (u,v) of the pixel of a camera ray at its closest hit, 0 without ray
+// differentials : the rays through the next pixels cross the tangent plane at rec.p, the
+// offsets to rec.p are projected on dpdu, dpdv. Once per ray, on the final record.
+inline double uv_footprint(const ray& r, const hit_record& rec) {
+    if (!r.has_differentials)
+        return 0;
+    double d00 = dot(rec.dpdu, rec.dpdu), d01 = dot(rec.dpdu, rec.dpdv), d11 = dot(rec.dpdv, rec.dpdv);
+    double denom = d00 * d11 - d01 * d01;
+    if (denom == 0)
+        return 1;
+
+    const vec3 *directions[2] = { &r.dx, &r.dy };
+    double width = 0;
+    for (int k = 0; k < 2; ++k) {
+        double d = dot(rec.normal, *directions[k]);
+        double t = d != 0 ? dot(rec.normal, rec.p - r.orig) / d : -1;
+        if (t <= 0)
+            return 1;   // grazing, the whole texture
+        vec3 q = r.orig + t * *directions[k] - rec.p;
+        double d20 = dot(q, rec.dpdu), d21 = dot(q, rec.dpdv);
+        double du = (d11 * d20 - d01 * d21) / denom;
+        double dv = (d00 * d21 - d01 * d20) / denom;
+        width = std::max(width, sqrt(du*du + dv*dv));
+    }
+    return width;
+}
+
 class hittable {
     public:
         virtual point3 point( const float u, const float v ) const = 0;
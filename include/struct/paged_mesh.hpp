@@ -0,0 +1,543 @@
+#ifndef PAGED_MESH_H
+#define PAGED_MESH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../utility.hpp"
+#include "../stats.hpp"
+
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "triangle.hpp"
+
+// Out-of-core meshes (--out-of-core MB) : the triangles of a mesh are not built as objects,
+// they are written in pages of a file mapped in memory, and read from there.
+//
+// The builder splits the mesh like bvh_node (median of the longest axis, on the centers)
+// until a part fits in a page : the triangles of a page are close to each other. A page
+// holds the small tree of its triangles and the triangles themselves. Only the top of the
+// tree, down to the pages, stays in memory (one node per half page of triangles).
+//
+// The pages are loaded by the system on first access. page_cache keeps at most its
+// capacity of pages resident : a page used by a ray is marked, and above the capacity the
+// pages not used since the last turn of the clock are dropped (madvise / fadvise), read
+// again from the file on their next use. A page dropped while a thread reads it is read
+// again by the system, so the size of the cache never changes the image.
+//
+// Only the render is out of core, not the load : read_obj parses the whole OBJ in memory
+// before the pages are written. The load holds the positions (24 B per vertex), the
+// triangles (16 B) and the items of the builder (16 B + 4 B per triangle), about 48 MB
+// for a mesh of 1M triangles and 500k vertices whose pages take 268 MB. A mesh is paged
+// if its parsed form fits in memory, even when its pages do not.
+//
+//   page  : page_header, the nodes of the page, then the triangles, geometry_page_bytes
+
+struct out_of_core_settings {
+    bool enabled = false;
+    size_t cache_bytes = size_t(256) << 20;
+    std::string directory = ".";        // of the page files, removed as soon as created
+};
+
+// set with --out-of-core MB and --page-dir
+inline out_of_core_settings& out_of_core() {
+    static out_of_core_settings settings;
+    return settings;
+}
+
+const size_t geometry_page_bytes = 1 << 16;
+
+struct page_node {
+    double lo[3], hi[3];
+    uint32_t first;     // inner : second child (the first one follows), leaf : first triangle (page in the top tree)
+    uint32_t count;     // 0 : inner node
+};
+
+struct page_triangle {
+    double a[3], b[3], c[3];
+    int32_t material;   // -1 : no material
+    uint32_t pad;
+};
+
+struct page_header {
+    uint32_t node_count;
+    uint32_t triangle_count;
+    uint64_t pad;
+};
+
+// the tree of a page has less nodes than triangles, leaves hold 2 to page_leaf_size triangles
+const uint32_t page_triangle_capacity = (geometry_page_bytes - sizeof(page_header)) / (sizeof(page_node) + sizeof(page_triangle));
+const uint32_t page_leaf_size = 4;
+const size_t page_triangles_offset = sizeof(page_header) + page_triangle_capacity * sizeof(page_node);
+
+enum page_state : uint8_t { page_resident = 1, page_referenced = 2 };
+
+// Pages of one mesh, in a file removed from its directory as soon as it is created.
+class page_file {
+    public:
+        page_file() : fd(-1), mapping(nullptr), page_count(0) {}
+        page_file(const page_file&) = delete;
+        page_file& operator=(const page_file&) = delete;
+        ~page_file();
+
+        bool create(const std::string& directory);
+        bool write(uint32_t page, const char *data);
+        bool map();
+
+        // page p, counted by the cache
+        inline const char *page(uint32_t p) const;
+
+        size_t bytes() const { return size_t(page_count) * geometry_page_bytes; }
+
+    public:
+        int fd;
+        char *mapping;
+        uint32_t page_count;
+        std::unique_ptr<std::atomic<uint8_t>[]> state;
+};
+
+// Resident pages of every page_file, process wide, like texture_cache.
+class page_cache {
+    public:
+        static page_cache& instance() {
+            static page_cache cache;
+            return cache;
+        }
+
+        void set_capacity(size_t bytes) {
+            std::lock_guard<std::mutex> guard(lock);
+            capacity = std::max<size_t>(1, bytes / geometry_page_bytes);
+            while (slots.size() > capacity) {
+                evict(slots.back());
+                slots.pop_back();
+            }
+            hand = 0;
+        }
+
+        void hit() {
+            counter().hits.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // page p of file is not resident : one slot for it, with the clock
+        void fault(page_file& file, uint32_t p) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (file.state[p].load(std::memory_order_relaxed) & page_resident) {
+                counter().hits.fetch_add(1, std::memory_order_relaxed);
+                return;     // loaded by another thread meanwhile
+            }
+            counter().misses.fetch_add(1, std::memory_order_relaxed);
+            madvise(file.mapping + size_t(p) * geometry_page_bytes, geometry_page_bytes, MADV_WILLNEED);
+
+            if (slots.size() < capacity) {
+                slots.push_back({&file, p});
+            } else {
+                // a second chance for the pages used since the last turn
+                for (;;) {
+                    slot& s = slots[hand];
+                    hand = (hand + 1) % slots.size();
+                    if (s.file->state[s.page].load(std::memory_order_relaxed) & page_referenced) {
+                        s.file->state[s.page].fetch_and(uint8_t(~page_referenced), std::memory_order_relaxed);
+                        continue;
+                    }
+                    evict(s);
+                    s = {&file, p};
+                    break;
+                }
+            }
+            resident = std::max(resident, slots.size());
+            file.state[p].store(page_resident | page_referenced, std::memory_order_relaxed);
+        }
+
+        // file is destroyed, its slots are free
+        void forget(page_file& file) {
+            std::lock_guard<std::mutex> guard(lock);
+            slots.erase(std::remove_if(slots.begin(), slots.end(), [&](const slot& s){ return s.file == &file; }), slots.end());
+            hand = 0;
+        }
+
+        void add_file(const page_file& file) {
+            std::lock_guard<std::mutex> guard(lock);
+            pages += file.page_count;
+        }
+
+        void report() {
+            std::lock_guard<std::mutex> guard(lock);
+            if (pages == 0)
+                return;
+            unsigned long hits = 0, misses = 0;
+            for (const thread_counters& c : counters) {
+                hits += c.hits.load(std::memory_order_relaxed);
+                misses += c.misses.load(std::memory_order_relaxed);
+            }
+            std::cerr << "geometry pages : " << pages << " pages of " << geometry_page_bytes / 1024 << " KB, cache of "
+                      << capacity << " pages (peak " << resident << "), " << hits << " hits, " << misses << " misses ("
+                      << 100.0 * hits / std::max(1ul, hits + misses) << " % hits), " << evictions << " evicted" << std::endl;
+        }
+
+    private:
+        struct slot {
+            page_file *file;
+            uint32_t page;
+        };
+
+        // one cache line per thread, the counters of a hit are not shared
+        struct alignas(64) thread_counters {
+            std::atomic<unsigned long> hits{0};
+            std::atomic<unsigned long> misses{0};
+        };
+        static const int counter_count = 256;
+
+        page_cache() : capacity(std::max<size_t>(1, out_of_core().cache_bytes / geometry_page_bytes)), hand(0),
+            pages(0), resident(0), evictions(0), counters(counter_count) {}
+
+        thread_counters& counter() { return counters[omp_get_thread_num() % counter_count]; }
+
+        void evict(const slot& s) {
+            size_t offset = size_t(s.page) * geometry_page_bytes;
+            s.file->state[s.page].store(0, std::memory_order_relaxed);
+            madvise(s.file->mapping + offset, geometry_page_bytes, MADV_DONTNEED);
+            posix_fadvise(s.file->fd, offset, geometry_page_bytes, POSIX_FADV_DONTNEED);
+            evictions++;
+        }
+
+    private:
+        std::mutex lock;
+        size_t capacity;        // pages
+        std::vector<slot> slots;
+        size_t hand;
+        size_t pages;
+        size_t resident;
+        unsigned long evictions;
+        std::vector<thread_counters> counters;
+};
+
+page_file::~page_file() {
+    if (mapping) {
+        page_cache::instance().forget(*this);
+        munmap(mapping, bytes());
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+bool page_file::create(const std::string& directory) {
+    std::string name = directory + "/rtpagesXXXXXX";
+    fd = mkstemp(&name[0]);
+    if (fd < 0) {
+        std::cerr << "[error] creating a page file in " << directory << std::endl;
+        return false;
+    }
+    unlink(name.c_str());
+    return true;
+}
+
+bool page_file::write(uint32_t page, const char *data) {
+    size_t done = 0;
+    off_t offset = off_t(page) * geometry_page_bytes;
+    while (done < geometry_page_bytes) {
+        ssize_t n = pwrite(fd, data + done, geometry_page_bytes - done, offset + done);
+        if (n <= 0) {
+            std::cerr << "[error] writing page " << page << std::endl;
+            return false;
+        }
+        done += n;
+    }
+    page_count = std::max(page_count, page + 1);
+    return true;
+}
+
+// Map the written pages and drop them from memory : the render starts with none resident.
+bool page_file::map() {
+    fdatasync(fd);
+    void *m = mmap(nullptr, bytes(), PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        std::cerr << "[error] mapping " << bytes() / 1e6 << " MB of pages" << std::endl;
+        return false;
+    }
+    mapping = static_cast<char *>(m);
+    madvise(mapping, bytes(), MADV_RANDOM);
+    posix_fadvise(fd, 0, bytes(), POSIX_FADV_DONTNEED);
+    state.reset(new std::atomic<uint8_t>[page_count]);
+    for (uint32_t p = 0; p < page_count; ++p)
+        state[p].store(0, std::memory_order_relaxed);
+    page_cache::instance().add_file(*this);
+    return true;
+}
+
+inline const char *page_file::page(uint32_t p) const {
+    uint8_t s = state[p].load(std::memory_order_relaxed);
+    if (s & page_resident) {
+        if (!(s & page_referenced))
+            state[p].fetch_or(page_referenced, std::memory_order_relaxed);
+        page_cache::instance().hit();
+    } else {
+        page_cache::instance().fault(const_cast<page_file&>(*this), p);
+    }
+    return mapping + size_t(p) * geometry_page_bytes;
+}
+
+class paged_mesh : public hittable {
+    public:
+        static const int max_depth = 64;
+
+        // count triangles, vertices(i, v, material) gives the 3 vertices of triangle i and
+        // its index in materials (-1 : none)
+        template <class F>
+        bool build(size_t count, F vertices, const std::vector<shared_ptr<material>>& mats);
+
+        virtual point3 point( const float u, const float v ) const override {
+            return point3(0,0,0);
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            const page_node& n = nodes[0];
+            output_box = aabb(point3(n.lo[0], n.lo[1], n.lo[2]), point3(n.hi[0], n.hi[1], n.hi[2]));
+            return true;
+        }
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            double origin[3], inverse[3];
+            for (int a = 0; a < 3; ++a) {
+                origin[a] = r.origin()[a];
+                inverse[a] = 1.0 / r.direction()[a];
+            }
+            traversal_probe *probe = active_probe();
+            const int level = probe ? probe->level : 0;
+            double closest = t_max;
+            bool found = walk(nodes.data(), origin, inverse, t_min, closest, level, [&](const page_node& leaf, int depth){
+                const char *page = file.page(leaf.first);
+                const page_node *local = reinterpret_cast<const page_node *>(page + sizeof(page_header));
+                const page_triangle *triangles = reinterpret_cast<const page_triangle *>(page + page_triangles_offset);
+                // the root of the page is the leaf of the top tree
+                return walk(local, origin, inverse, t_min, closest, depth - 1, [&](const page_node& n, int depth){
+                    if (probe) probe->level = depth;
+                    bool found = false;
+                    for (uint32_t i = n.first; i < n.first + n.count; ++i) {
+                        const page_triangle& t = triangles[i];
+                        triangle tri(point3(t.a[0], t.a[1], t.a[2]), point3(t.b[0], t.b[1], t.b[2]),
+                            point3(t.c[0], t.c[1], t.c[2]), nullptr);
+                        if (tri.hit(r, t_min, closest, rec)) {
+                            rec.mat_ptr = t.material >= 0 ? materials[t.material] : nullptr;
+                            closest = rec.t;
+                            found = true;
+                        }
+                    }
+                    return found;
+                });
+            });
+            if (probe) probe->level = level;
+            return found;
+        }
+
+    private:
+        struct item {
+            float center[3];
+            uint32_t index;
+        };
+
+        static bool slab(const page_node& n, const double origin[3], const double inverse[3],
+            double t_min, double t_max, double& t_near) {
+            for (int a = 0; a < 3; ++a) {
+                double t0 = (n.lo[a] - origin[a]) * inverse[a];
+                double t1 = (n.hi[a] - origin[a]) * inverse[a];
+                if (inverse[a] < 0)
+                    std::swap(t0, t1);
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if (t_max < t_min)      // a flat box (axis aligned triangles) is hit
+                    return false;
+            }
+            t_near = t_min;
+            return true;
+        }
+
+        // closest hit in the tree of nodes, leaf(node, depth) tests the triangles of a leaf
+        // and lowers closest. depth counts the nodes above the objects of the leaf, from
+        // level for the root
+        template <class Leaf>
+        static bool walk(const page_node *nodes, const double origin[3], const double inverse[3],
+            double t_min, double& closest, int level, Leaf leaf) {
+            traversal_probe *probe = active_probe();
+            struct entry { uint32_t index; int depth; double t_near; };
+            entry stack[max_depth + 1];
+            int top = 0;
+            double t_near;
+            if (!slab(nodes[0], origin, inverse, t_min, closest, t_near))
+                return false;
+            stack[top++] = { 0, level, t_near };
+
+            bool hit_anything = false;
+            while (top > 0) {
+                const entry e = stack[--top];
+                if (e.t_near > closest)
+                    continue;
+                RT_STAT(nodes++);
+                if (probe) probe->nodes++;
+                const page_node& n = nodes[e.index];
+                if (n.count > 0) {
+                    hit_anything = leaf(n, e.depth + 1) || hit_anything;
+                    continue;
+                }
+                // the nearest child on the top of the stack
+                const uint32_t children[2] = { e.index + 1, n.first };
+                double t[2];
+                bool in[2];
+                for (int c = 0; c < 2; ++c)
+                    in[c] = slab(nodes[children[c]], origin, inverse, t_min, closest, t[c]);
+                if (in[0] && in[1]) {
+                    int near = t[1] < t[0] ? 1 : 0;
+                    stack[top++] = { children[1-near], e.depth + 1, t[1-near] };
+                    stack[top++] = { children[near], e.depth + 1, t[near] };
+                } else if (in[0] || in[1]) {
+                    int c = in[0] ? 0 : 1;
+                    stack[top++] = { children[c], e.depth + 1, t[c] };
+                }
+            }
+            return hit_anything;
+        }
+
+        // splits items[start, end[ in two halves on the longest axis of their centers
+        static size_t split(std::vector<item>& items, size_t start, size_t end) {
+            float lo[3], hi[3];
+            for (int a = 0; a < 3; ++a)
+                lo[a] = hi[a] = items[start].center[a];
+            for (size_t i = start + 1; i < end; ++i) {
+                for (int a = 0; a < 3; ++a) {
+                    lo[a] = std::min(lo[a], items[i].center[a]);
+                    hi[a] = std::max(hi[a], items[i].center[a]);
+                }
+            }
+            int axis = 0;
+            if (hi[1] - lo[1] > hi[axis] - lo[axis]) axis = 1;
+            if (hi[2] - lo[2] > hi[axis] - lo[axis]) axis = 2;
+            size_t mid = (start + end) / 2;
+            std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+                [axis](const item& a, const item& b){ return a.center[axis] < b.center[axis]; });
+            return mid;
+        }
+
+        static void merge(page_node& n, const page_node& a, const page_node& b) {
+            for (int k = 0; k < 3; ++k) {
+                n.lo[k] = std::min(a.lo[k], b.lo[k]);
+                n.hi[k] = std::max(a.hi[k], b.hi[k]);
+            }
+        }
+
+        // tree of the triangles of items[start, end[ in a page, depth first
+        template <class F>
+        static uint32_t build_page(std::vector<item>& items, size_t start, size_t end, size_t base, F& vertices,
+            page_node *local, uint32_t& node_count, page_triangle *triangles) {
+            uint32_t index = node_count++;
+            page_node& n = local[index];
+            if (end - start <= page_leaf_size) {
+                for (int a = 0; a < 3; ++a) {
+                    n.lo[a] = infinity;
+                    n.hi[a] = -infinity;
+                }
+                for (size_t i = start; i < end; ++i) {
+                    point3 v[3];
+                    int material = -1;
+                    vertices(items[i].index, v, material);
+                    page_triangle& t = triangles[i - base];
+                    for (int a = 0; a < 3; ++a) {
+                        t.a[a] = v[0][a];
+                        t.b[a] = v[1][a];
+                        t.c[a] = v[2][a];
+                        n.lo[a] = std::min(n.lo[a], std::min(v[0][a], std::min(v[1][a], v[2][a])));
+                        n.hi[a] = std::max(n.hi[a], std::max(v[0][a], std::max(v[1][a], v[2][a])));
+                    }
+                    t.material = material;
+                }
+                n.first = start - base;
+                n.count = end - start;
+                return index;
+            }
+            size_t mid = split(items, start, end);
+            build_page(items, start, mid, base, vertices, local, node_count, triangles);
+            uint32_t right = build_page(items, mid, end, base, vertices, local, node_count, triangles);
+            merge(n, local[index + 1], local[right]);
+            n.first = right;
+            n.count = 0;
+            return index;
+        }
+
+        // node of items[start, end[ in the top tree, a page when they fit
+        template <class F>
+        uint32_t build_node(std::vector<item>& items, size_t start, size_t end, F& vertices, std::vector<char>& page, bool& ok) {
+            uint32_t index = nodes.size();
+            nodes.emplace_back();
+            if (end - start <= page_triangle_capacity) {
+                std::fill(page.begin(), page.end(), 0);
+                page_header *header = reinterpret_cast<page_header *>(page.data());
+                page_node *local = reinterpret_cast<page_node *>(page.data() + sizeof(page_header));
+                page_triangle *triangles = reinterpret_cast<page_triangle *>(page.data() + page_triangles_offset);
+                uint32_t node_count = 0;
+                build_page(items, start, end, start, vertices, local, node_count, triangles);
+                header->node_count = node_count;
+                header->triangle_count = end - start;
+
+                page_node& n = nodes[index];
+                n = local[0];
+                n.first = file.page_count;
+                n.count = end - start;
+                ok = ok && file.write(file.page_count, page.data());
+                return index;
+            }
+            size_t mid = split(items, start, end);
+            build_node(items, start, mid, vertices, page, ok);
+            uint32_t right = build_node(items, mid, end, vertices, page, ok);
+            page_node& n = nodes[index];
+            merge(n, nodes[index + 1], nodes[right]);
+            n.first = right;
+            n.count = 0;
+            return index;
+        }
+
+    public:
+        std::vector<page_node> nodes;       // top of the tree, resident, the leaves are pages
+        std::vector<shared_ptr<material>> materials;
+        page_file file;
+};
+
+template <class F>
+bool paged_mesh::build(size_t count, F vertices, const std::vector<shared_ptr<material>>& mats)
+{
+    if (count == 0 || count >= UINT32_MAX || !file.create(out_of_core().directory))
+        return false;
+    materials = mats;
+
+    std::vector<item> items(count);
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < long(count); ++i) {
+        point3 v[3];
+        int material = -1;
+        vertices(size_t(i), v, material);
+        for (int a = 0; a < 3; ++a)
+            items[i].center[a] = float((v[0][a] + v[1][a] + v[2][a]) / 3);
+        items[i].index = uint32_t(i);
+    }
+
+    bool ok = true;
+    std::vector<char> page(geometry_page_bytes);
+    build_node(items, 0, count, vertices, page, ok);
+    if (!ok || !file.map())
+        return false;
+
+    std::cerr << "paged mesh : " << count << " triangles in " << file.page_count << " pages, " << file.bytes() / 1e6
+              << " MB mapped, " << nodes.size() * sizeof(page_node) / 1e6 << " MB resident" << std::endl;
+    return true;
+}
+
+#endif
@@ -1,108 +1,151 @@
 #ifndef PERLIN_H
 #define PERLIN_H
 
-#include "../utility.hpp"
+#include <algorithm>
+#include <cstdint>
 
-class perlin {
-    public:
-        perlin() {
-            ranvec = new vec3[point_count];
-            for (int i = 0; i < point_count; ++i) {
-                ranvec[i] = unit_vector(vec3::random(-1,1));
-            }
+#include "../utility.hpp"
 
-            perm_x = perlin_generate_perm();
-            perm_y = perlin_generate_perm();
-            perm_z = perlin_generate_perm();
+// Perlin noise with gradient and permutation tables generated at compile time, from a
+// fixed seed : the noise of a scene does not depend on the random state when it is loaded.
+//
+// turb() hashes the cells of all its octaves and computes the 8 corner dot products
+// first (table lookups, scalar), then interpolates every octave in one loop that the
+// compiler vectorizes, one octave per lane (omp simd).
+
+namespace perlin_tables {
+
+    const int point_count = 256;
+
+    struct tables {
+        int perm_x[point_count];
+        int perm_y[point_count];
+        int perm_z[point_count];
+        double gradient_x[point_count];     // unit vectors, one array per axis
+        double gradient_y[point_count];
+        double gradient_z[point_count];
+    };
+
+    constexpr uint32_t next(uint32_t& state) {
+        // xorshift32
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // in [-1,1[
+    constexpr double next_double(uint32_t& state) {
+        return next(state) / 2147483648.0 - 1.0;
+    }
+
+    constexpr double sqrt_newton(double x) {
+        double r = x > 1 ? x : 1;
+        for (int i = 0; i < 64; ++i)
+            r = 0.5 * (r + x / r);
+        return r;
+    }
+
+    constexpr void permute(int *p, uint32_t& state) {
+        for (int i = 0; i < point_count; ++i)
+            p[i] = i;
+        for (int i = point_count-1; i > 0; i--) {
+            int target = next(state) % (i + 1);
+            int tmp = p[i];
+            p[i] = p[target];
+            p[target] = tmp;
         }
-
-        ~perlin() {
-            delete[] ranvec;
-            delete[] perm_x;
-            delete[] perm_y;
-            delete[] perm_z;
+    }
+
+    constexpr tables generate(uint32_t seed) {
+        tables t = {};
+        uint32_t state = seed;
+        for (int i = 0; i < point_count; ++i) {
+            // random direction : point of the unit ball, rejected outside or near 0
+            double x = 0, y = 0, z = 0, l2 = 0;
+            do {
+                x = next_double(state);
+                y = next_double(state);
+                z = next_double(state);
+                l2 = x*x + y*y + z*z;
+            } while (l2 > 1 || l2 < 1e-4);
+            double l = sqrt_newton(l2);
+            t.gradient_x[i] = x / l;
+            t.gradient_y[i] = y / l;
+            t.gradient_z[i] = z / l;
         }
+        permute(t.perm_x, state);
+        permute(t.perm_y, state);
+        permute(t.perm_z, state);
+        return t;
+    }
+
+    constexpr tables table = generate(0x9e3779b9u);
+}
+
+class perlin {
+    public:
+        static const int max_octaves = 16;
 
         double noise(const point3& p) const {
-            auto u = p.x - floor(p.x);
-            auto v = p.y - floor(p.y);
-            auto w = p.z - floor(p.z);
-            auto i = static_cast<int>(floor(p.x));
-            auto j = static_cast<int>(floor(p.y));
-            auto k = static_cast<int>(floor(p.z));
-            vec3 c[2][2][2];
-
-            for (int di=0; di < 2; di++)
-                for (int dj=0; dj < 2; dj++)
-                    for (int dk=0; dk < 2; dk++)
-                        c[di][dj][dk] = ranvec[
-                            perm_x[(i+di) & 255] ^
-                            perm_y[(j+dj) & 255] ^
-                            perm_z[(k+dk) & 255]
-                        ];
-
-            return perlin_interp(c, u, v, w);
+            return octaves(p, 1);
         }
 
         double turb(const point3& p, int depth=7) const {
-            auto accum = 0.0;
-            auto temp_p = p;
-            auto weight = 1.0;
-
-            for (int i = 0; i < depth; i++) {
-                accum += weight*noise(temp_p);
-                weight *= 0.5;
-                temp_p *= 2;
-            }
-
-            return fabs(accum);
+            return fabs(octaves(p, std::min(depth, int(max_octaves))));
         }
 
     private:
-        static const int point_count = 256;
-        vec3* ranvec;
-        int* perm_x;
-        int* perm_y;
-        int* perm_z;
-
-        static int* perlin_generate_perm() {
-            auto p = new int[point_count];
-
-            for (int i = 0; i < perlin::point_count; i++)
-                p[i] = i;
-
-            permute(p, point_count);
-
-            return p;
-        }
-
-        static void permute(int* p, int n) {
-            for (int i = n-1; i > 0; i--) {
-                int target = random_int(0, i);
-                int tmp = p[i];
-                p[i] = p[target];
-                p[target] = tmp;
+        // sum of depth octaves of noise, weights 1, 1/2, 1/4 ...
+        static double octaves(const point3& p, int depth) {
+            using perlin_tables::table;
+            alignas(64) double u[max_octaves], v[max_octaves], w[max_octaves];
+            alignas(64) double weight[max_octaves];
+            alignas(64) double d[8][max_octaves];     // dot products, corner (di dj dk) = 4 di + 2 dj + dk
+
+            double frequency = 1.0;
+            for (int o = 0; o < depth; ++o) {
+                double x = p.x * frequency, y = p.y * frequency, z = p.z * frequency;
+                weight[o] = 1.0 / frequency;
+                frequency *= 2;
+
+                // floor without the libm call
+                int i = static_cast<int>(x), j = static_cast<int>(y), k = static_cast<int>(z);
+                i -= x < i;
+                j -= y < j;
+                k -= z < k;
+                u[o] = x - i;
+                v[o] = y - j;
+                w[o] = z - k;
+
+                int hx[2] = { table.perm_x[i & 255], table.perm_x[(i+1) & 255] };
+                int hy[2] = { table.perm_y[j & 255], table.perm_y[(j+1) & 255] };
+                int hz[2] = { table.perm_z[k & 255], table.perm_z[(k+1) & 255] };
+                for (int c = 0; c < 8; ++c) {
+                    int di = c >> 2, dj = (c >> 1) & 1, dk = c & 1;
+                    int h = hx[di] ^ hy[dj] ^ hz[dk];
+                    d[c][o] = table.gradient_x[h] * (u[o] - di)
+                            + table.gradient_y[h] * (v[o] - dj)
+                            + table.gradient_z[h] * (w[o] - dk);
+                }
             }
-        }
-
-        static double perlin_interp(vec3 c[2][2][2], double u, double v, double w) {
-            auto uu = u*u*(3-2*u);
-            auto vv = v*v*(3-2*v);
-            auto ww = w*w*(3-2*w);
-            auto accum = 0.0;
-
-            for (int i=0; i < 2; i++)
-                for (int j=0; j < 2; j++)
-                    for (int k=0; k < 2; k++) {
-                        vec3 weight_v(u-i, v-j, w-k);
-                        accum += (i*uu + (1-i)*(1-uu))
-                               * (j*vv + (1-j)*(1-vv))
-                               * (k*ww + (1-k)*(1-ww))
-                               * dot(c[i][j][k], weight_v);
-                    }
 
+            double accum = 0.0;
+            #pragma omp simd reduction(+:accum)
+            for (int o = 0; o < depth; ++o) {
+                double uu = u[o]*u[o]*(3-2*u[o]);
+                double vv = v[o]*v[o]*(3-2*v[o]);
+                double ww = w[o]*w[o]*(3-2*w[o]);
+                double d00 = d[0][o] + ww * (d[1][o] - d[0][o]);
+                double d01 = d[2][o] + ww * (d[3][o] - d[2][o]);
+                double d10 = d[4][o] + ww * (d[5][o] - d[4][o]);
+                double d11 = d[6][o] + ww * (d[7][o] - d[6][o]);
+                double d0 = d00 + vv * (d01 - d00);
+                double d1 = d10 + vv * (d11 - d10);
+                accum += weight[o] * (d0 + uu * (d1 - d0));
+            }
             return accum;
         }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,298 @@
+#ifndef QUANTIZED_BVH_H
+#define QUANTIZED_BVH_H
+
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include "../utility.hpp"
+#include "../stats.hpp"
+#include "../trace.hpp"
+
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "bvh.hpp"
+#include "arena.hpp"
+
+// Compact BVH : the tree of a bvh_node, stored in one array of small nodes. A node holds
+// the boxes of its two children quantized on 8 or 16 bits inside its own box, and the
+// index of each child (node, or primitive). Only the root box is stored in full, the
+// traversal decodes the boxes on the way down.
+//
+// Quantization is conservative : the lower bound rounds down and the upper bound up,
+// checked with the decoding used by the traversal, relative to the decoded box of the
+// parent. A decoded box always contains the exact one, so no hit is lost.
+//
+//   bvh_node            : vtable, 2 shared_ptr, aabb (with its own vtable), > 90 bytes
+//   quantized_node<8>   : 20 bytes
+//   quantized_node<16>  : 32 bytes
+
+enum bvh_layout { bvh_pointers = 0, bvh_quantized8 = 8, bvh_quantized16 = 16 };
+
+// layout of the BVH of the scenes loaded from now on, set with --bvh
+inline bvh_layout& scene_bvh_layout() {
+    static bvh_layout layout = bvh_pointers;
+    return layout;
+}
+
+struct box3 {
+    double min[3], max[3];
+};
+
+template <typename Q>
+struct quantized_node {
+    static const uint32_t leaf = 0x80000000u;    // child is a primitive
+    static const uint32_t none = 0xffffffffu;    // no second child
+    static constexpr int levels = std::numeric_limits<Q>::max();
+
+    Q lo[2][3];
+    Q hi[2][3];
+    uint32_t child[2];
+
+    // size of a quantization step of the box of the node, on each axis
+    static void steps(const box3& parent, double step[3]) {
+        for (int a = 0; a < 3; ++a)
+            step[a] = (parent.max[a] - parent.min[a]) * (1.0 / levels);
+    }
+
+    // the last level is the bound of the parent, without rounding (a select, no branch)
+    static double decode(const box3& parent, const double step[3], int axis, int q) {
+        double value = parent.min[axis] + q * step[axis];
+        return q == levels ? parent.max[axis] : value;
+    }
+
+    box3 box(const box3& parent, const double step[3], int c) const {
+        box3 b;
+        for (int a = 0; a < 3; ++a) {
+            b.min[a] = decode(parent, step, a, lo[c][a]);
+            b.max[a] = decode(parent, step, a, hi[c][a]);
+        }
+        return b;
+    }
+
+    // smallest decoded box of parent that contains exact
+    void encode(const box3& parent, const double step[3], int c, const aabb& exact) {
+        for (int a = 0; a < 3; ++a) {
+            int l = 0, h = levels;
+            if (step[a] > 0) {
+                l = std::max(0, std::min(levels, static_cast<int>(floor((exact.min()[a] - parent.min[a]) / step[a]))));
+                h = std::max(0, std::min(levels, static_cast<int>(ceil((exact.max()[a] - parent.min[a]) / step[a]))));
+            }
+            while (l > 0 && decode(parent, step, a, l) > exact.min()[a])
+                l--;
+            while (l < h && decode(parent, step, a, l + 1) <= exact.min()[a])
+                l++;
+            while (h < levels && decode(parent, step, a, h) < exact.max()[a])
+                h++;
+            while (h > l && decode(parent, step, a, h - 1) >= exact.max()[a])
+                h--;
+            lo[c][a] = Q(l);
+            hi[c][a] = Q(h);
+        }
+    }
+};
+
+template <typename Q>
+class quantized_bvh : public hittable {
+    public:
+        typedef quantized_node<Q> node;
+        static const int max_depth = 64;
+
+        // bvh_node trees deeper than max_depth are not converted, see valid()
+        quantized_bvh(const bvh_node& tree) : pointer_nodes(0), depth(0) {
+            for (int a = 0; a < 3; ++a) {
+                root.min[a] = tree.box.min()[a];
+                root.max[a] = tree.box.max()[a];
+            }
+            nodes.emplace_back();
+            encode(tree, 0, root, 1);
+        }
+
+        bool valid() const { return depth <= max_depth; }
+
+        virtual point3 point( const float u, const float v ) const override {
+            return point3(0,0,0);
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = aabb(point3(root.min[0], root.min[1], root.min[2]), point3(root.max[0], root.max[1], root.max[2]));
+            return true;
+        }
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            double origin[3], inverse[3];
+            for (int a = 0; a < 3; ++a) {
+                origin[a] = r.origin()[a];
+                inverse[a] = 1.0 / r.direction()[a];
+            }
+            double t_near;
+            if (!slab(root, origin, inverse, t_min, t_max, t_near))
+                return false;
+
+            // the probe of a heatmap sees the depth of the leaves as in the bvh_node tree
+            traversal_probe *probe = active_probe();
+            const int level = probe ? probe->level : 0;
+
+            struct entry { uint32_t index; uint32_t depth; double t_near; box3 box; };
+            entry stack[max_depth + 1];
+            int top = 0;
+            stack[top++] = { 0, 0, t_near, root };
+
+            bool hit_anything = false;
+            double closest = t_max;
+            while (top > 0) {
+                const entry e = stack[--top];     // copy, its slot is reused by the children
+                if (e.t_near > closest)
+                    continue;
+                RT_STAT(nodes++);
+                if (probe) probe->nodes++;
+                const node& n = nodes[e.index];
+                double step[3];
+                node::steps(e.box, step);
+
+                // both children decoded and tested together, without branches (one lane
+                // each), then the hits pushed straight on the stack, the nearest last
+                entry *inner = stack + top;
+                box3 box[2];
+                double t_in[2] = { t_min, t_min }, t_out[2] = { closest, closest };
+                for (int a = 0; a < 3; ++a) {
+                    for (int c = 0; c < 2; ++c) {
+                        box[c].min[a] = node::decode(e.box, step, a, n.lo[c][a]);
+                        box[c].max[a] = node::decode(e.box, step, a, n.hi[c][a]);
+                        double t0 = (box[c].min[a] - origin[a]) * inverse[a];
+                        double t1 = (box[c].max[a] - origin[a]) * inverse[a];
+                        double t_enter = inverse[a] < 0 ? t1 : t0;
+                        double t_exit = inverse[a] < 0 ? t0 : t1;
+                        t_in[c] = t_enter > t_in[c] ? t_enter : t_in[c];
+                        t_out[c] = t_exit < t_out[c] ? t_exit : t_out[c];
+                    }
+                }
+                // >= : the box of an axis aligned triangle is flat, entered and left at once
+                int count = 0;
+                for (int c = 0; c < 2; ++c) {
+                    if (n.child[c] == node::none || !(t_out[c] >= t_in[c]))
+                        continue;
+                    if (n.child[c] & node::leaf) {
+                        if (probe) probe->level = level + e.depth + 1;
+                        if (primitives[n.child[c] & ~node::leaf]->hit(r, t_min, closest, rec)) {
+                            hit_anything = true;
+                            closest = rec.t;
+                        }
+                    } else {
+                        inner[count].index = n.child[c];
+                        inner[count].depth = e.depth + 1;
+                        inner[count].t_near = t_in[c];
+                        inner[count].box = box[c];
+                        count++;
+                    }
+                }
+                if (count == 2 && inner[0].t_near < inner[1].t_near)
+                    std::swap(inner[0], inner[1]);
+                top += count;
+            }
+            if (probe) probe->level = level;
+            return hit_anything;
+        }
+
+        size_t bytes() const {
+            return nodes.size() * sizeof(node) + primitives.size() * sizeof(shared_ptr<hittable>);
+        }
+
+        // memory of the bvh_node tree it replaces
+        size_t pointer_bytes() const { return pointer_nodes * sizeof(bvh_node); }
+
+    private:
+        static bool slab(const box3& b, const double origin[3], const double inverse[3],
+            double t_min, double t_max, double& t_near) {
+            for (int a = 0; a < 3; ++a) {
+                double t0 = (b.min[a] - origin[a]) * inverse[a];
+                double t1 = (b.max[a] - origin[a]) * inverse[a];
+                if (inverse[a] < 0)
+                    std::swap(t0, t1);
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if (t_max < t_min)
+                    return false;
+            }
+            t_near = t_min;
+            return true;
+        }
+
+        // children of tree in nodes[index], whose decoded box is box
+        void encode(const bvh_node& tree, uint32_t index, const box3& box, int level) {
+            pointer_nodes++;
+            depth = std::max(depth, level);
+            const shared_ptr<hittable> children[2] = { tree.left, tree.right };
+            for (int c = 0; c < 2; ++c) {
+                if (c == 1 && tree.right == tree.left) {
+                    nodes[index].child[c] = node::none;
+                    continue;
+                }
+                aabb exact;
+                children[c]->bounding_box(0, 1, exact);
+                double step[3];
+                node::steps(box, step);
+                nodes[index].encode(box, step, c, exact);
+                box3 decoded = nodes[index].box(box, step, c);
+
+                if (const bvh_node *inner = dynamic_cast<const bvh_node *>(children[c].get())) {
+                    uint32_t child = nodes.size();
+                    nodes[index].child[c] = child;
+                    nodes.emplace_back();
+                    encode(*inner, child, decoded, level + 1);
+                } else {
+                    nodes[index].child[c] = node::leaf | uint32_t(primitives.size());
+                    primitives.push_back(children[c]);
+                }
+            }
+        }
+
+    public:
+        box3 root;
+        std::vector<node> nodes;                        // depth first, root first
+        std::vector<shared_ptr<hittable>> primitives;   // in the order of the leaves
+
+    private:
+        size_t pointer_nodes;
+        int depth;
+};
+
+// leaves of a quantized_bvh, nullptr for other objects
+const std::vector<shared_ptr<hittable>> *quantized_primitives(const hittable *h)
+{
+    if (auto q8 = dynamic_cast<const quantized_bvh<uint8_t> *>(h))
+        return &q8->primitives;
+    if (auto q16 = dynamic_cast<const quantized_bvh<uint16_t> *>(h))
+        return &q16->primitives;
+    return nullptr;
+}
+
+// tree as a quantized_bvh, or tree itself with bvh_pointers
+shared_ptr<hittable> compress_bvh(const shared_ptr<bvh_node>& tree, const bvh_layout layout)
+{
+    RT_TRACE("compress_bvh");
+    shared_ptr<hittable> compact;
+    size_t bytes = 0, before = 0, count = 0;
+    bool valid = false;
+    if (layout == bvh_quantized8) {
+        auto q = scene_new<quantized_bvh<uint8_t>>(*tree);
+        compact = q;
+        bytes = q->bytes(); before = q->pointer_bytes(); count = q->primitives.size(); valid = q->valid();
+    } else if (layout == bvh_quantized16) {
+        auto q = scene_new<quantized_bvh<uint16_t>>(*tree);
+        compact = q;
+        bytes = q->bytes(); before = q->pointer_bytes(); count = q->primitives.size(); valid = q->valid();
+    } else
+        return tree;
+
+    if (!valid) {
+        std::cerr << "[warning] bvh deeper than " << quantized_bvh<uint8_t>::max_depth << " levels, not quantized" << std::endl;
+        return tree;
+    }
+    std::cerr << "bvh " << int(layout) << " bits : " << count << " primitives, " << double(before) / count
+              << " -> " << double(bytes) / count << " node bytes per primitive" << std::endl;
+    return compact;
+}
+
+#endif
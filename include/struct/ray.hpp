@@ -5,9 +5,15 @@
 
 class ray {
     public:
-        ray() {}
+        ray() : has_differentials(false) {}
         ray(const point3& origin, const vec3& direction)
-            : orig(origin), dir(direction)
+            : orig(origin), dir(direction), has_differentials(false)
+        {}
+
+        // camera ray with the directions of the rays through the next pixel in x and in y,
+        // from the same origin, to estimate the footprint of the pixel at the hit point
+        ray(const point3& origin, const vec3& direction, const vec3& direction_dx, const vec3& direction_dy)
+            : orig(origin), dir(direction), dx(direction_dx), dy(direction_dy), has_differentials(true)
         {}
 
         point3 origin() const  { return orig; }
@@ -20,6 +26,8 @@ class ray {
     public:
         point3 orig;
         vec3 dir;
+        vec3 dx, dy;
+        bool has_differentials;
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
+#include "../stats.hpp"
+
 #include "hittable.hpp"
 #include "vec3.hpp"
 
@@ -43,6 +45,9 @@ point3 sphere::point( const float u, const float v ) const
 }
 
 bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT(tests[stat_sphere]++);
+    traversal_probe *probe = active_probe();
+    if (probe) probe->tests++;
     vec3 oc = r.origin() - center;
     double a = r.direction().length_squared();
     double half_b = dot(oc, r.direction());
@@ -66,7 +71,15 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
+    if (r.has_differentials) {
+        // derivatives of u = phi / 2pi and v = theta / pi, none at the poles
+        const vec3& n = outward_normal;
+        double s = sqrt(n.x*n.x + n.z*n.z);
+        rec.dpdu = 2*pi*radius * vec3(n.z, 0, -n.x);
+        rec.dpdv = s > 0 ? pi*radius * vec3(-n.x*n.y / s, s, -n.y*n.z / s) : vec3(0, 0, 0);
+    }
     rec.mat_ptr = mat_ptr;
+    if (probe) probe->hit();
     return true;
 }
 
@@ -2,14 +2,23 @@
 #define TEXTURE_H
 
 #include "../utility.hpp"
+#include "../stats.hpp"
 
 #include "rtw_stb_image.hpp"
+#include "texture_cache.hpp"
+#include "arena.hpp"
 
+#include "aabb.hpp"
 #include "perlin.hpp"
 
 class texture {
     public:
         virtual color value(double u, double v, const point3& p) const = 0;
+
+        // footprint : width of the pixel in uv units at the hit point, see hit_record
+        virtual color value(double u, double v, const point3& p, double /*footprint*/) const {
+            return value(u, v, p);
+        }
 };
 
 class solid_color : public texture {
@@ -21,10 +30,11 @@ class solid_color : public texture {
           : solid_color(color(red,green,blue)) {}
 
         virtual color value(double u, double v, const vec3& p) const override {
+            RT_STAT(fetches[stat_solid]++);
             return color_value;
         }
 
-    private:
+    public:
         color color_value;
 };
 
@@ -36,9 +46,10 @@ class checker_texture : public texture {
             : even(_even), odd(_odd) {}
 
         checker_texture(color c1, color c2)
-            : even(make_shared<solid_color>(c1)) , odd(make_shared<solid_color>(c2)) {}
+            : even(scene_new<solid_color>(c1)) , odd(scene_new<solid_color>(c2)) {}
 
         virtual color value(double u, double v, const point3& p) const override {
+            RT_STAT(fetches[stat_checker]++);
             auto sines = sin(10*p.x)*sin(10*p.y)*sin(10*p.z);
             if (sines < 0)
                 return odd->value(u, v, p);
@@ -51,18 +62,73 @@ class checker_texture : public texture {
         shared_ptr<texture> even;
 };
 
+// resolution of the noise bakes (cells along the longest side of the box), 0 : evaluated
+inline int& noise_bake_resolution() {
+    static int resolution = 0;
+    return resolution;
+}
+
 class noise_texture : public texture {
     public:
         noise_texture() {}
         noise_texture(double sc) : scale(sc) {}
 
         virtual color value(double u, double v, const point3& p) const override {
-            return color(1,1,1) * 0.5 * (1 + sin(scale*p.z + 10*noise.turb(p)));
+            RT_STAT(fetches[stat_noise]++);
+            return color(1,1,1) * 0.5 * (1 + sin(scale*p.z + 10*turbulence(p)));
+        }
+
+        // Sample the turbulence on a grid over box, looked up trilinearly inside the box.
+        // Details smaller than a cell are lost : a cache for distant or blurred surfaces.
+        void bake(const aabb& box, int resolution) {
+            vec3 size = box.max() - box.min();
+            double longest = std::max(size.x, std::max(size.y, size.z));
+            if (resolution <= 0 || longest <= 0)
+                return;
+            cell = longest / resolution;
+            origin = box.min();
+            for (int a = 0; a < 3; ++a)
+                nodes[a] = static_cast<int>(ceil(size[a] / cell)) + 1;
+            grid.resize(size_t(nodes[0]) * nodes[1] * nodes[2]);
+
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (int k = 0; k < nodes[2]; ++k)
+                for (int j = 0; j < nodes[1]; ++j)
+                    for (int i = 0; i < nodes[0]; ++i)
+                        grid[(size_t(k) * nodes[1] + j) * nodes[0] + i] = float(noise.turb(origin + cell * vec3(i, j, k)));
+        }
+
+        size_t baked_bytes() const { return grid.size() * sizeof(float); }
+
+    private:
+        double turbulence(const point3& p) const {
+            if (grid.empty())
+                return noise.turb(p);
+            double x = (p.x - origin.x) / cell, y = (p.y - origin.y) / cell, z = (p.z - origin.z) / cell;
+            if (x < 0 || y < 0 || z < 0 || x > nodes[0]-1 || y > nodes[1]-1 || z > nodes[2]-1)
+                return noise.turb(p);
+            int i = std::min(static_cast<int>(x), std::max(nodes[0]-2, 0));
+            int j = std::min(static_cast<int>(y), std::max(nodes[1]-2, 0));
+            int k = std::min(static_cast<int>(z), std::max(nodes[2]-2, 0));
+            int i1 = std::min(i+1, nodes[0]-1), j1 = std::min(j+1, nodes[1]-1), k1 = std::min(k+1, nodes[2]-1);
+            double fx = x - i, fy = y - j, fz = z - k;
+            auto at = [&](int a, int b, int c) { return double(grid[(size_t(c) * nodes[1] + b) * nodes[0] + a]); };
+            double c00 = (1-fx) * at(i, j, k) + fx * at(i1, j, k);
+            double c10 = (1-fx) * at(i, j1, k) + fx * at(i1, j1, k);
+            double c01 = (1-fx) * at(i, j, k1) + fx * at(i1, j, k1);
+            double c11 = (1-fx) * at(i, j1, k1) + fx * at(i1, j1, k1);
+            return (1-fz) * ((1-fy) * c00 + fy * c10) + fz * ((1-fy) * c01 + fy * c11);
         }
 
     public:
         perlin noise;
         double scale;
+
+    private:
+        std::vector<float> grid;        // turbulence at the nodes, x fastest
+        point3 origin;
+        double cell = 1;
+        int nodes[3] = {0, 0, 0};
 };
 
 
@@ -71,53 +137,41 @@ class image_texture : public texture {
     public:
         const static int bytes_per_pixel = 3;
 
-        image_texture()
-          : data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
-
-        image_texture(const char* filename) {
-            auto components_per_pixel = bytes_per_pixel;
+        image_texture() {}
 
-            data = stbi_load(
-                filename, &width, &height, &components_per_pixel, components_per_pixel);
+        // levels stored by somebody else (a mapped scene file), not in the cache
+        image_texture(const std::vector<mip_level>& levels)
+          : image(make_shared<texture_entry>(levels)) {}
 
-            if (!data) {
-                std::cerr << "ERROR: Could not load texture image file '" << filename << "'.\n";
-                width = height = 0;
-            }
+        // shared with every other texture of the same file, see texture_cache
+        image_texture(const char* filename)
+          : image(texture_cache::instance().acquire(filename)) {}
 
-            bytes_per_scanline = bytes_per_pixel * width;
+        virtual color value(double u, double v, const vec3& p) const override {
+            return value(u, v, p, 0);
         }
 
-        ~image_texture() {
-            delete data;
-        }
+        virtual color value(double u, double v, const vec3& p, double footprint) const override {
+            RT_STAT(fetches[stat_image]++);
+            const texture_pixels *pixels = image ? image->get() : nullptr;
 
-        virtual color value(double u, double v, const vec3& p) const override {
             // If we have no texture data, then return solid cyan as a debugging aid.
-            if (data == nullptr)
+            if (pixels == nullptr)
                 return color(0,1,1);
 
             // Clamp input texture coordinates to [0,1] x [1,0]
             u = clamp(u, 0.0, 1.0);
             v = 1.0 - clamp(v, 0.0, 1.0);  // Flip V to image coordinates
 
-            auto i = static_cast<int>(u * width);
-            auto j = static_cast<int>(v * height);
-
-            // Clamp integer mapping, since actual coordinates should be less than 1.0
-            if (i >= width)  i = width-1;
-            if (j >= height) j = height-1;
-
-            const auto color_scale = 1.0 / 255.0;
-            auto pixel = data + j*bytes_per_scanline + i*bytes_per_pixel;
-
-            return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
+            switch (texture_filtering()) {
+                case filter_nearest : return pixels->nearest(u, v);
+                case filter_bilinear : return pixels->bilinear(0, u, v);
+                default : return pixels->trilinear(u, v, footprint);
+            }
         }
 
-    private:
-        unsigned char *data;
-        int width, height;
-        int bytes_per_scanline;
+    public:
+        shared_ptr<texture_entry> image;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,355 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../utility.hpp"
+#include "../trace.hpp"
+
+#include "rtw_stb_image.hpp"
+
+// Process-wide cache of decoded images, keyed by path.
+//
+// image_texture holds a handle (shared_ptr<texture_entry>) instead of its own pixels, so
+// every texture of the same file shares one decoded image. Images are decoded either all
+// at once, in parallel, by load_pending() at the end of a scene load, or lazily by the
+// first value() that needs them (set_lazy(true)).
+//
+// The cache keeps decoded images after their textures are gone, to reuse them for the
+// next scene. Above the memory cap, the least recently used images are evicted (a use is
+// an acquire, a decode, or a get() of a render pass) : at any time the ones no texture
+// uses any more, and between two render passes (render_pass calls evict_between_passes)
+// also the pixels of images in use. Their handle stays, the next get() decodes the image
+// again. During a pass the render threads hold bare
+// pointers on the pixels, so the images in use may exceed the cap until the next pass.
+
+const int texture_tile = 8;     // texels per side of a tile
+
+// One level of a MIP pyramid : rgb float texels stored by tiles of texture_tile x
+// texture_tile texels, so a bilinear lookup mostly reads one tile. Tiles are stored row
+// by row, and the texels of a tile row by row. Row 0 is the top of the image.
+struct mip_level {
+    int width, height;
+    int tiles_x, tiles_y;
+    const float *texels;
+
+    static size_t floats(int w, int h) {
+        return size_t((w + texture_tile - 1) / texture_tile) * ((h + texture_tile - 1) / texture_tile)
+            * texture_tile * texture_tile * 3;
+    }
+
+    const float *texel(int i, int j) const {
+        int tile = (j / texture_tile) * tiles_x + i / texture_tile;
+        int k = (j % texture_tile) * texture_tile + i % texture_tile;
+        return texels + (size_t(tile) * texture_tile * texture_tile + k) * 3;
+    }
+};
+
+// size of the next level, down to 1x1
+inline int mip_size(int s) { return std::max(1, (s + 1) / 2); }
+
+inline int mip_count(int w, int h) {
+    int n = 1;
+    for (; w > 1 || h > 1; ++n) {
+        w = mip_size(w);
+        h = mip_size(h);
+    }
+    return n;
+}
+
+enum texture_filter { filter_nearest, filter_bilinear, filter_trilinear };
+
+inline texture_filter& texture_filtering() {
+    static texture_filter filter = filter_trilinear;
+    return filter;
+}
+
+// Decoded image, as a MIP pyramid of linear float texels (8 bit value / 255).
+class texture_pixels {
+    public:
+        // 8 bit rgb image, row 0 at the top, reduced by 2x2 boxes down to 1x1
+        texture_pixels(const unsigned char *rgb, int w, int h) {
+            int n = mip_count(w, h);
+            size_t total = 0;
+            for (int l = 0, lw = w, lh = h; l < n; ++l, lw = mip_size(lw), lh = mip_size(lh))
+                total += mip_level::floats(lw, lh);
+            storage.resize(total);
+
+            float *texels = storage.data();
+            for (int l = 0, lw = w, lh = h; l < n; ++l, lw = mip_size(lw), lh = mip_size(lh)) {
+                mip_level level = { lw, lh, (lw + texture_tile - 1) / texture_tile, (lh + texture_tile - 1) / texture_tile, texels };
+                levels.push_back(level);
+                texels += mip_level::floats(lw, lh);
+            }
+
+            for (int j = 0; j < h; ++j) {
+                for (int i = 0; i < w; ++i) {
+                    float *t = const_cast<float *>(levels[0].texel(i, j));
+                    const unsigned char *pixel = rgb + (size_t(j) * w + i) * 3;
+                    for (int c = 0; c < 3; ++c)
+                        t[c] = pixel[c] / 255.0f;
+                }
+            }
+            for (int l = 1; l < n; ++l) {
+                const mip_level& up = levels[l-1];
+                for (int j = 0; j < levels[l].height; ++j) {
+                    for (int i = 0; i < levels[l].width; ++i) {
+                        int i0 = std::min(2*i, up.width-1), i1 = std::min(2*i+1, up.width-1);
+                        int j0 = std::min(2*j, up.height-1), j1 = std::min(2*j+1, up.height-1);
+                        float *t = const_cast<float *>(levels[l].texel(i, j));
+                        for (int c = 0; c < 3; ++c)
+                            t[c] = 0.25f * (up.texel(i0, j0)[c] + up.texel(i1, j0)[c] + up.texel(i0, j1)[c] + up.texel(i1, j1)[c]);
+                    }
+                }
+            }
+        }
+
+        // levels stored by somebody else (mapped scene file)
+        texture_pixels(const std::vector<mip_level>& views) : levels(views) {}
+
+        texture_pixels(const texture_pixels&) = delete;
+        texture_pixels& operator=(const texture_pixels&) = delete;
+
+        // memory owned, mapped levels are not counted
+        size_t bytes() const { return storage.size() * sizeof(float); }
+
+        int width() const { return levels[0].width; }
+        int height() const { return levels[0].height; }
+
+        // u, v in [0,1], v = 0 at the top
+        color nearest(double u, double v) const {
+            const mip_level& l = levels[0];
+            int i = std::min(static_cast<int>(u * l.width), l.width - 1);
+            int j = std::min(static_cast<int>(v * l.height), l.height - 1);
+            const float *t = l.texel(i, j);
+            return color(t[0], t[1], t[2]);
+        }
+
+        color bilinear(int level, double u, double v) const {
+            const mip_level& l = levels[level];
+            double x = u * l.width - 0.5;
+            double y = v * l.height - 0.5;
+            int i0 = static_cast<int>(floor(x));
+            int j0 = static_cast<int>(floor(y));
+            double fx = x - i0;
+            double fy = y - j0;
+            int i1 = std::min(i0 + 1, l.width - 1);
+            int j1 = std::min(j0 + 1, l.height - 1);
+            i0 = std::max(i0, 0);
+            j0 = std::max(j0, 0);
+
+            const float *t00 = l.texel(i0, j0), *t10 = l.texel(i1, j0);
+            const float *t01 = l.texel(i0, j1), *t11 = l.texel(i1, j1);
+            color c;
+            for (int k = 0; k < 3; ++k)
+                c[k] = (1-fy) * ((1-fx) * t00[k] + fx * t10[k]) + fy * ((1-fx) * t01[k] + fx * t11[k]);
+            return c;
+        }
+
+        // footprint : width of the pixel in uv units, 0 for the finest level
+        color trilinear(double u, double v, double footprint) const {
+            double lod = footprint > 0 ? log2(footprint * std::max(width(), height())) : 0;
+            int last = int(levels.size()) - 1;
+            if (lod <= 0)
+                return bilinear(0, u, v);
+            if (lod >= last)
+                return bilinear(last, u, v);
+            int l = static_cast<int>(lod);
+            double f = lod - l;
+            return (1-f) * bilinear(l, u, v) + f * bilinear(l+1, u, v);
+        }
+
+    public:
+        std::vector<mip_level> levels;
+        std::vector<float> storage;
+};
+
+class texture_cache;
+
+// Handle on one image. get() returns nullptr when the file can not be decoded.
+class texture_entry {
+    public:
+        texture_entry(const std::string& p) : path(p), loaded(nullptr), failed(false), last_use(0) {}
+
+        // levels stored by somebody else (mapped scene file), not in the cache
+        texture_entry(const std::vector<mip_level>& levels)
+            : pixels(std::make_shared<texture_pixels>(levels)), loaded(pixels.get()), failed(false), last_use(0) {}
+
+        inline const texture_pixels *get() const;
+
+    public:
+        std::string path;
+        std::mutex lock;
+        shared_ptr<texture_pixels> pixels;
+        std::atomic<const texture_pixels *> loaded;
+        std::atomic<bool> failed;
+        mutable std::atomic<unsigned long> last_use;    // clock of the cache
+};
+
+class texture_cache {
+    public:
+        static texture_cache& instance() {
+            static texture_cache cache;
+            return cache;
+        }
+
+        // Handle on path, decoded later.
+        shared_ptr<texture_entry> acquire(const std::string& path) {
+            std::lock_guard<std::mutex> guard(lock);
+            shared_ptr<texture_entry>& entry = entries[path];
+            if (entry) {
+                hits++;
+            } else {
+                entry = make_shared<texture_entry>(path);
+                misses++;
+            }
+            entry->last_use = ++clock;
+            return entry;
+        }
+
+        // Decode the image of entry once, thread safe.
+        const texture_pixels *load(texture_entry& entry) {
+            std::lock_guard<std::mutex> guard(entry.lock);
+            if (entry.loaded || entry.failed)
+                return entry.loaded;
+
+            RT_TRACE("decode_texture");
+            int width, height, components = 3;
+            unsigned char *data = stbi_load(entry.path.c_str(), &width, &height, &components, 3);
+            if (!data) {
+                std::cerr << "ERROR: Could not load texture image file '" << entry.path << "'.\n";
+                entry.failed = true;
+                return nullptr;
+            }
+            entry.pixels = std::make_shared<texture_pixels>(data, width, height);
+            stbi_image_free(data);
+            entry.loaded = entry.pixels.get();
+
+            std::lock_guard<std::mutex> cache_guard(lock);
+            entry.last_use = ++clock;
+            bytes += entry.pixels->bytes();
+            peak = std::max(peak, bytes);
+            decoded++;
+            trim_locked();
+            return entry.loaded;
+        }
+
+        // Decode every image not loaded yet, in parallel.
+        void load_pending() {
+            if (lazy)
+                return;
+            std::vector<shared_ptr<texture_entry>> pending;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                for (auto& e : entries)
+                    if (!e.second->loaded && !e.second->failed)
+                        pending.push_back(e.second);
+            }
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (int i = 0; i < (int) pending.size(); ++i)
+                load(*pending[i]);
+        }
+
+        // Evict unused images until the memory cap is met.
+        void trim() {
+            std::lock_guard<std::mutex> guard(lock);
+            trim_locked();
+        }
+
+        // Evict images in use as well, when no render thread reads pixels.
+        void evict_between_passes() {
+            if (capacity == 0)
+                return;
+            std::lock_guard<std::mutex> guard(lock);
+            trim_locked();
+            while (bytes > capacity) {
+                // least recently acquired or decoded image
+                texture_entry *victim = nullptr;
+                for (auto& e : entries) {
+                    if (e.second->loaded && (victim == nullptr || e.second->last_use < victim->last_use))
+                        victim = e.second.get();
+                }
+                // an image being decoded holds its lock : wait for the next pass
+                if (victim == nullptr || !victim->lock.try_lock())
+                    break;
+                bytes -= victim->pixels->bytes();
+                victim->loaded = nullptr;
+                victim->pixels.reset();
+                victim->lock.unlock();
+                evictions++;
+            }
+            // the reads of the next pass are newer than the ones of this pass
+            ++clock;
+        }
+
+        void set_capacity(size_t cap) {
+            capacity = cap;
+            trim();
+        }
+
+        void set_lazy(bool l) { lazy = l; }
+
+        // stamp of a use, advanced by every acquire and decode and by every render pass
+        unsigned long now() const { return clock.load(std::memory_order_relaxed); }
+
+        void report() {
+            std::lock_guard<std::mutex> guard(lock);
+            std::cerr << "textures : " << entries.size() << " images, " << bytes / 1e6 << " MB (peak " << peak / 1e6
+                      << " MB), " << decoded << " decoded, " << hits << " shared, " << evictions << " evicted" << std::endl;
+            if (capacity > 0 && bytes > capacity)
+                std::cerr << "[warning] textures in use exceed the cache cap of " << capacity / 1e6
+                          << " MB until the next render pass" << std::endl;
+        }
+
+    private:
+        texture_cache() : capacity(0), lazy(false), bytes(0), peak(0), clock(0),
+            hits(0), misses(0), decoded(0), evictions(0) {}
+
+        void trim_locked() {
+            while (capacity > 0 && bytes > capacity) {
+                // least recently acquired image that only the cache holds
+                auto victim = entries.end();
+                for (auto it = entries.begin(); it != entries.end(); ++it) {
+                    if (it->second.use_count() == 1 && it->second->loaded
+                        && (victim == entries.end() || it->second->last_use < victim->second->last_use))
+                        victim = it;
+                }
+                if (victim == entries.end())
+                    break;
+                bytes -= victim->second->pixels->bytes();
+                evictions++;
+                entries.erase(victim);
+            }
+        }
+
+    private:
+        std::mutex lock;
+        std::map<std::string, shared_ptr<texture_entry>> entries;
+        size_t capacity;        // bytes, 0 : no cap
+        bool lazy;
+        size_t bytes;
+        size_t peak;
+        std::atomic<unsigned long> clock;
+        unsigned long hits, misses, decoded, evictions;
+};
+
+inline const texture_pixels *texture_entry::get() const {
+    const texture_pixels *p = loaded.load(std::memory_order_acquire);
+    // written once per pass, not on every fetch
+    const unsigned long now = texture_cache::instance().now();
+    if (last_use.load(std::memory_order_relaxed) != now)
+        last_use.store(now, std::memory_order_relaxed);
+    if (p || failed)
+        return p;
+    return texture_cache::instance().load(const_cast<texture_entry&>(*this));
+}
+
+#endif
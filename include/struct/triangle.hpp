@@ -1,6 +1,8 @@
 #ifndef TRIANGLE_H
 #define TRIANGLE_H
 
+#include "../stats.hpp"
+
 #include "hittable.hpp"
 #include "vec3.hpp"
 
@@ -29,6 +31,9 @@ point3 triangle::point( const float u, const float v ) const
 }
 
 bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT(tests[stat_triangle]++);
+    traversal_probe *probe = active_probe();
+    if (probe) probe->tests++;
 
     const double EPSILON = 0.0000001;
 
@@ -64,14 +69,17 @@ bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     double t= dot(ac, qvec) * inv_det;
 
     // ne renvoie vrai que si l'intersection est valide (comprise entre tmin et tmax du rayon)
-    if (t <= t_max && t > EPSILON){
+    if (t <= t_max && t > EPSILON && t > t_min){
         rec.t = t;
         rec.u = u;
         rec.v = v;
         rec.p = r.origin() + r.direction() * t;
         rec.normal = cross(ab,ac);
         rec.set_face_normal(r, rec.normal);
+        rec.dpdu = ab;
+        rec.dpdv = ac;
         rec.mat_ptr = mat_ptr;
+        if (probe) probe->hit();
         return true;
     }
     return false;
@@ -1,23 +1,77 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include <cfloat>
 #include <cmath>
 #include <iostream>
 
+#if defined(RT_FAST_MATH) && (defined(__SSE__) || defined(__x86_64__))
+#include <xmmintrin.h>
+#endif
+
 using std::sqrt;
 
+// vec3 is three doubles, or with -DRT_SIMD (cmake -DRT_SIMD=ON) four lanes of a GCC / clang
+// vector, the last one padding : the operators are lane-wise vector operations, AVX on x86
+// (cmake adds -mavx if the build host runs AVX), NEON on arm64, and x, y, z stay the
+// members of the scalar version. Each lane does the operations of the scalar code in the
+// same order, the images are the same. dot() and length_squared() sum the three lanes only, the padding may hold
+// anything. With SSE2 only the vectors are split in halves, slower than the scalar code.
+//
+// -DRT_FAST_MATH (cmake -DRT_FAST_MATH=ON) swaps some functions for approximations, the
+// images differ in the last bits : unit_vector() from a reciprocal square root estimate
+// refined by Newton steps, pow(x, 5) of Schlick's reflectance by multiplications.
+
+#ifdef RT_SIMD
+#if defined(__x86_64__) && !defined(__AVX__)
+#warning "RT_SIMD without AVX (-mavx) is slower than the scalar vec3"
+#endif
+
+typedef double vec4d __attribute__((vector_size(32)));
+
+#if defined(__clang__)
+#define VEC3_SWIZZLE(v, a, b, c) __builtin_shufflevector(v, v, a, b, c, 3)
+#else
+typedef long long vec4i __attribute__((vector_size(32)));
+#define VEC3_SWIZZLE(v, a, b, c) __builtin_shuffle(v, vec4i{a, b, c, 3})
+#endif
+#endif
+
 class vec3 {
     public:
+#ifdef RT_SIMD
+        union {
+            vec4d v;
+            struct { double x, y, z, w; };
+        };
+
+        vec3() : v{0, 0, 0, 0} {}
+        vec3(double e0, double e1, double e2) : v{e0, e1, e2, 0} {}
+        explicit vec3(const vec4d& lanes) : v(lanes) {}
+
+        vec3 operator-() const { return vec3(-v); }
+        double operator[](int i) const { return v[i]; }
+        double& operator[](int i) { return this->*components[i]; }
+
+        vec3& operator+=(const vec3 &u) {
+            v += u.v;
+            return *this;
+        }
+
+        vec3& operator*=(const double t) {
+            v *= t;
+            return *this;
+        }
+#else
         double x, y, z;
 
         vec3() : x(0), y(0), z(0) {}
         vec3(double e0, double e1, double e2) : x(e0), y(e1), z(e2) {}
 
         vec3 operator-() const { return vec3(-x, -y, -z); }
-        double operator[](int i) const 
-            { if (i==0) return x; if (i==1) return y; if (i==2) return z; std::cerr << "out of range" << std::endl; return z;}
-        double& operator[](int i) 
-            { if (i==0) return x; if (i==1) return y; if (i==2) return z; std::cerr << "out of range" << std::endl; return z;}
+        // no branch : the members are selected by offset
+        double operator[](int i) const { return this->*components[i]; }
+        double& operator[](int i) { return this->*components[i]; }
 
         vec3& operator+=(const vec3 &v) {
             x += v.x;
@@ -32,6 +86,7 @@ class vec3 {
             z *= t;
             return *this;
         }
+#endif
 
         vec3& operator/=(const double t) {
             return *this *= 1/t;
@@ -58,6 +113,9 @@ class vec3 {
         inline static vec3 random(double min, double max) {
             return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
         }
+
+    private:
+        static constexpr double vec3::*components[3] = { &vec3::x, &vec3::y, &vec3::z };
 };
 
 // Type aliases for vec3
@@ -70,6 +128,23 @@ inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
     return out << v.x << ' ' << v.y << ' ' << v.z;
 }
 
+#ifdef RT_SIMD
+inline vec3 operator+(const vec3 &u, const vec3 &v) {
+    return vec3(u.v + v.v);
+}
+
+inline vec3 operator-(const vec3 &u, const vec3 &v) {
+    return vec3(u.v - v.v);
+}
+
+inline vec3 operator*(const vec3 &u, const vec3 &v) {
+    return vec3(u.v * v.v);
+}
+
+inline vec3 operator*(double t, const vec3 &v) {
+    return vec3(t * v.v);
+}
+#else
 inline vec3 operator+(const vec3 &u, const vec3 &v) {
     return vec3(u.x + v.x, u.y + v.y, u.z + v.z);
 }
@@ -85,6 +160,7 @@ inline vec3 operator*(const vec3 &u, const vec3 &v) {
 inline vec3 operator*(double t, const vec3 &v) {
     return vec3(t*v.x, t*v.y, t*v.z);
 }
+#endif
 
 inline vec3 operator*(const vec3 &v, double t) {
     return t * v;
@@ -94,6 +170,18 @@ inline vec3 operator/(vec3 v, double t) {
     return (1/t) * v;
 }
 
+#ifdef RT_SIMD
+inline double dot(const vec3 &u, const vec3 &v) {
+    vec4d p = u.v * v.v;
+    return p[0] + p[1] + p[2];
+}
+
+// u.yzx * v.zxy - u.zxy * v.yzx
+inline vec3 cross(const vec3 &u, const vec3 &v) {
+    return vec3(VEC3_SWIZZLE(u.v, 1, 2, 0) * VEC3_SWIZZLE(v.v, 2, 0, 1)
+              - VEC3_SWIZZLE(u.v, 2, 0, 1) * VEC3_SWIZZLE(v.v, 1, 2, 0));
+}
+#else
 inline double dot(const vec3 &u, const vec3 &v) {
     return u.x * v.x
          + u.y * v.y
@@ -105,10 +193,31 @@ inline vec3 cross(const vec3 &u, const vec3 &v) {
                 u.z * v.x - u.x * v.z,
                 u.x * v.y - u.y * v.x);
 }
+#endif
+
+#ifdef RT_FAST_MATH
+// 1 / sqrt(x) : estimate on 12 bits (rsqrtss), two Newton steps bring it to ~46 bits.
+// The estimate is in float : outside its normal range (0, tiny, huge, inf, nan) sqrt is used.
+inline double fast_rsqrt(double x) {
+    if (!(x >= FLT_MIN && x <= FLT_MAX))
+        return 1.0 / sqrt(x);
+#if defined(__SSE__) || defined(__x86_64__)
+    double r = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(float(x))));
+#else
+    double r = 1.0f / sqrtf(float(x));
+#endif
+    r = r * (1.5 - 0.5 * x * r * r);
+    return r * (1.5 - 0.5 * x * r * r);
+}
 
+inline vec3 unit_vector(vec3 v) {
+    return v * fast_rsqrt(v.length_squared());
+}
+#else
 inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
+#endif
 
 vec3 random_in_unit_sphere() {
     while (true) {
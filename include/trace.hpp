@@ -0,0 +1,193 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "utility.hpp"
+
+// Timeline of the run in the Chrome trace event format (--trace file.json), to open in
+// Perfetto (ui.perfetto.dev) or chrome://tracing : one span per traced scope, on the
+// thread that ran it, with an optional integer argument (pass, band...).
+//
+//   RT_TRACE("read_obj");              // until the end of the block
+//   RT_TRACE_ARG("rows", pass);
+//
+// Disabled (the default) a scope only reads one flag. Enabled, it reads the clock twice
+// and appends the span to the buffer of its thread, without a lock. The buffers are
+// written by write_trace(), the ones of the finished threads (image encoders) included.
+
+struct trace_event {
+    const char *name;       // a literal
+    long long arg;
+    bool has_arg;
+    int64_t begin, end;     // ns since the start of the trace
+};
+
+struct trace_buffer;
+
+class trace_log {
+    public:
+        static trace_log& instance() {
+            static trace_log log;
+            return log;
+        }
+
+        void enable() {
+            start = std::chrono::steady_clock::now();
+            enabled = true;
+        }
+
+        int64_t now() const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        void enter(trace_buffer *b) {
+            std::lock_guard<std::mutex> guard(lock);
+            threads.push_back(b);
+        }
+
+        inline void leave(trace_buffer *b);
+        bool write(const char *filename);
+
+    public:
+        bool enabled = false;   // set before the threads start
+
+    private:
+        trace_log() {}
+
+        struct thread_events {
+            long tid;
+            std::string name;
+            std::vector<trace_event> events;
+        };
+
+        std::mutex lock;
+        std::vector<trace_buffer *> threads;
+        std::vector<thread_events> retired;
+        std::chrono::steady_clock::time_point start;
+};
+
+struct trace_buffer {
+    long tid;
+    std::string name;
+    std::vector<trace_event> events;
+
+    trace_buffer() {
+        tid = syscall(SYS_gettid);
+        bool omp = false;
+#ifdef _OPENMP
+        omp = omp_in_parallel();
+#endif
+        name = tid == getpid() ? "main"
+             : omp ? "omp thread " + std::to_string(thread_id())
+                   : "thread " + std::to_string(tid);
+        trace_log::instance().enter(this);
+    }
+    ~trace_buffer() { trace_log::instance().leave(this); }
+};
+
+inline void trace_log::leave(trace_buffer *b) {
+    std::lock_guard<std::mutex> guard(lock);
+    retired.push_back({ b->tid, b->name, std::move(b->events) });
+    for (size_t i = 0; i < threads.size(); ++i) {
+        if (threads[i] == b) {
+            threads[i] = threads.back();
+            threads.pop_back();
+            break;
+        }
+    }
+}
+
+inline trace_buffer& thread_trace() {
+    static thread_local trace_buffer buffer;
+    return buffer;
+}
+
+class trace_scope {
+    public:
+        trace_scope(const char *name) : name(name), arg(0), has_arg(false), on(trace_log::instance().enabled) {
+            if (on) begin = trace_log::instance().now();
+        }
+        trace_scope(const char *name, long long arg) : name(name), arg(arg), has_arg(true), on(trace_log::instance().enabled) {
+            if (on) begin = trace_log::instance().now();
+        }
+        ~trace_scope() {
+            if (on) thread_trace().events.push_back({ name, arg, has_arg, begin, trace_log::instance().now() });
+        }
+
+    private:
+        const char *name;
+        long long arg;
+        bool has_arg;
+        bool on;
+        int64_t begin;
+};
+
+#define RT_TRACE_NAME2(line) trace_scope_##line
+#define RT_TRACE_NAME(line) RT_TRACE_NAME2(line)
+#define RT_TRACE(name) trace_scope RT_TRACE_NAME(__LINE__)(name)
+#define RT_TRACE_ARG(name, arg) trace_scope RT_TRACE_NAME(__LINE__)(name, arg)
+
+// read while the threads are idle, after the render
+bool trace_log::write(const char *filename) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<thread_events> all = retired;
+    for (const trace_buffer *b : threads)
+        all.push_back({ b->tid, b->name, b->events });
+
+    FILE *out = fopen(filename, "wt");
+    if (out == NULL) {
+        std::cerr << "[error] writing " << filename << std::endl;
+        return false;
+    }
+    const long pid = getpid();
+    size_t count = 0;
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (const thread_events& t : all) {
+        fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": %ld, \"args\": {\"name\": \"%s\"}}",
+            count++ > 0 ? ",\n" : "", pid, t.tid, t.name.c_str());
+        for (const trace_event& e : t.events) {
+            fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"rt\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %ld, \"tid\": %ld",
+                e.name, e.begin * 1e-3, (e.end - e.begin) * 1e-3, pid, t.tid);
+            if (e.has_arg)
+                fprintf(out, ", \"args\": {\"value\": %lld}", e.arg);
+            fprintf(out, "}");
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0;
+}
+
+// enabled by --trace, before the scene is loaded
+inline void start_trace() { trace_log::instance().enable(); }
+
+bool write_trace(const char *filename) {
+    return trace_log::instance().enabled && trace_log::instance().write(filename);
+}
+
+// --trace of main : started here, written on every return of main (render, server, worker,
+// animation, scaling, interactive, errors)
+class trace_session {
+    public:
+        trace_session(const std::string& filename) : filename(filename) {
+            if (!filename.empty())
+                start_trace();
+        }
+        ~trace_session() {
+            if (!filename.empty() && write_trace(filename.c_str()))
+                std::cerr << "trace " << filename << " generated" << std::endl;
+        }
+
+    private:
+        std::string filename;
+};
+
+#endif
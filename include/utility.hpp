@@ -7,6 +7,10 @@
 #include <cstdlib>
 #include <random>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 // Usings
 
 using std::shared_ptr;
@@ -24,10 +28,39 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+inline int thread_id() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+inline int thread_count() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// Each thread owns its generator, so the sampler state of a pass is fully
+// described by (seed, pass, thread) and can be restored after a checkpoint.
+// stream separates work items rendered independently with the same pass, e.g. tiles.
+inline std::mt19937& sampler_generator() {
+    static thread_local std::mt19937 generator;
+    return generator;
+}
+
+inline void seed_sampler(unsigned int seed, unsigned int pass, unsigned int thread,
+    unsigned int stream = 0) {
+    std::seed_seq sequence{seed, pass, thread, stream};
+    sampler_generator().seed(sequence);
+}
+
 inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    static thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(sampler_generator());
 }
 
 inline double random_double(double min, double max) {
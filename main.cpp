@@ -4,230 +4,436 @@
 #include "include/material.hpp"
 #include "include/color.hpp"
 #include "include/ioutility.hpp"
+#include "include/progressive.hpp"
+#include "include/checkpoint.hpp"
+#include "include/preview.hpp"
+#include "include/render.hpp"
+#include "include/stats.hpp"
+#include "include/trace.hpp"
+#include "include/interactive.hpp"
+#include "include/distributed.hpp"
+#include "include/server.hpp"
+#include "include/animation.hpp"
+#include "include/largeframe.hpp"
+#include "include/heatmap.hpp"
+#include "include/scaling.hpp"
 #include "include/struct/bvh.hpp"
+#include "include/struct/bvh_report.hpp"
 
 #include <iostream>
-#include <SDL2/SDL.h>
 
-color ray_color(ray& r, color& background, hittable& world, int depth) {
-    hit_record rec;
-
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0,0,0);
-
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
+int main( int argc, char **argv ) {
 
-    ray scattered;
-    color attenuation;
-    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    bool PREVIEW = false;
+    bool INTERACTIVE = false;
+    int preview_fps = 30;
 
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
+    // Image
+    double aspect_ratio = 4.0 / 3.0;
+    int image_width = 800;
+    int samples_per_pixel = 1000;
+    int max_depth = 50;
+    std::string scene_name = "cornell_empty";
 
-    return emitted + attenuation * ray_color(scattered, background, world, depth-1);
-}
+    // Progressive mode : stop on a time budget (seconds) or a relative error target,
+    // write the current image every snapshot_interval seconds.
+    double time_budget = 0;
+    double noise_target = 0;
+    double snapshot_interval = 0;
+    bool spp_given = false;
 
-color indirect_ray_color(ray& r, color& background, hittable& world, int depth, const int & sample, const int & all_samples) {
-    hit_record rec;
+    // Checkpoints : save the accumulation buffer every checkpoint_interval seconds,
+    // resume a render from a checkpoint, or merge checkpoints of the same frame.
+    std::string checkpoint_file;
+    std::string resume_file;
+    double checkpoint_interval = 60;
+    std::vector<std::string> merge_files;
+    sampler_state sampler = {0, 0, 0.0, 0, ""};
 
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0,0,0);
+    // Distributed rendering : a coordinator hands tiles to workers over TCP.
+    int coordinator_port = 0;
+    std::string worker_address;
+    coordinator_settings distributed;
 
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
+    // Render server : "-" reads requests on stdin, otherwise a Unix socket path.
+    std::string server_path;
 
-    ray scattered;
-    color attenuation;
-    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    // Batch rendering of a camera path or a turntable against one scene build.
+    std::string camera_path;
+    int turntable_frames = 0;
+    animation_settings animation;
 
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
+    // Check the OBJ parser against the old loader on a file.
+    std::string check_obj_file;
 
-    // vec3 b1, b2;
-    // branchlessONB(scattered.dir, b1, b2);
-    // vec3 w = l2w(fibo(sample, all_samples), scattered.dir, b1, b2);
+    // Write the loaded scene in a binary scene file, loaded back with --scene file.rts.
+    std::string compile_file;
 
-    // ray fiboray(scattered.orig, w);
+    // Texture cache : memory cap in MB (0 : none), decode on first use instead of at load.
+    double texture_cache_mb = 0;
+    bool lazy_textures = false;
+    std::string texture_filter_name = "trilinear";  // nearest, bilinear or trilinear
 
-    return emitted + attenuation * ray_color(scattered, background, world, depth-1);
-    // return emitted + attenuation * ray_color(fiboray, background, world, depth-1);
-}
+    // Bake the noise textures on a grid of N cells along the longest side (0 : evaluated).
+    int bake_noise = 0;
 
-color direct_ray_color(ray& r, color& background, hittable& world, std::vector<shared_ptr <hittable> >& light, int depth, const int & sample, const int & all_samples) {
-    hit_record rec;
+    // BVH nodes : pointers, or child boxes quantized on 8 or 16 bits.
+    std::string bvh_name = "pointers";
 
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
+    // Timeline of the load, build, render and output (Chrome trace events) in a JSON file.
+    std::string trace_file;
 
-    // select random light in scene
-    int random_light_id = random_double(0, light.size());
-    auto random_light = light[random_light_id];
+    // Quality of the BVHs of the scene (SAH cost, overlap, depths, leaves) in a JSON file.
+    std::string bvh_report_file;
 
-    // select random point on light source
-    float u = sqrt(random_double());
-    float v = ( 1.0f - u ) * sqrt(random_double());
-    point3 light_point = random_light->point(u,v);
+    // Out-of-core meshes : triangles in pages of a mapped file, page cache in MB (0 : off).
+    double out_of_core_mb = 0;
+    std::string page_directory = ".";
 
-    // create ray between light point and hit point
-    ray direct_light_ray;
-    direct_light_ray.dir = rec.p - light_point;
-    direct_light_ray.orig = light_point;
+    // Output formats, comma separated : png, bmp, hdr, exr, exr32 (float channels), ppm.
+    std::string format_list;
 
-    hit_record rec_light;
-    // If the ray hits nothing, there is nothing between light and element, return material color.
-    if (!world.hit(direct_light_ray, 0.001, 0.999, rec_light)){
-        color attenuation;
-        color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-        ray scatter;
-        if (!rec.mat_ptr->scatter(r, rec, attenuation, scatter))
-            return emitted;
-        // if material is pure color return attenuation
-        if(rec.mat_ptr->isMatMaterial())
-            return attenuation;
-        else
-            return indirect_ray_color(r, background, world, depth, sample, all_samples);
-    }
-    return background;
-}
+    // Large frames : render by bands of band_rows rows streamed to exr / ppm (0 : off).
+    int band_rows = 0;
 
-int main( int argc, char **argv ) {
+    // Heatmaps of the camera rays, written before the render : nodes, prims, time, depth,
+    // each with an optional scale (nodes:200).
+    std::string heatmap_list;
 
-    bool PREVIEW = false;
-    SDL_Window *window;
-    SDL_Surface *window_surface;
+    // Thread scaling study : the passes of --spp (4 by default) at each thread count,
+    // for each pinning (none, compact, scatter), rows shared with --schedule.
+    bool scaling = false;
+    scaling_settings scaling_study;
 
-    if(argc > 1){
-        std::string value = argv[1];
+    for(int a = 1; a < argc; ++a){
+        std::string value = argv[a];
+        bool has_arg = a + 1 < argc;
         if(value == "--preview"){
             PREVIEW = true;
+        } else if(value == "--interactive"){
+            INTERACTIVE = true;
+        } else if(value == "--preview-fps" && has_arg){
+            preview_fps = std::max(1, atoi(argv[++a]));
+        } else if(value == "--scene" && has_arg){
+            scene_name = argv[++a];
+        } else if(value == "--width" && has_arg){
+            image_width = atoi(argv[++a]);
+        } else if(value == "--spp" && has_arg){
+            samples_per_pixel = atoi(argv[++a]);
+            spp_given = true;
+        } else if(value == "--depth" && has_arg){
+            max_depth = atoi(argv[++a]);
+        } else if(value == "--time" && has_arg){
+            time_budget = atof(argv[++a]);
+        } else if(value == "--noise" && has_arg){
+            noise_target = atof(argv[++a]);
+        } else if(value == "--snapshot" && has_arg){
+            snapshot_interval = atof(argv[++a]);
+        } else if(value == "--seed" && has_arg){
+            sampler.seed = atoi(argv[++a]);
+        } else if(value == "--checkpoint" && has_arg){
+            checkpoint_file = argv[++a];
+        } else if(value == "--checkpoint-interval" && has_arg){
+            checkpoint_interval = atof(argv[++a]);
+        } else if(value == "--resume" && has_arg){
+            resume_file = argv[++a];
+        } else if(value == "--server"){
+            server_path = (has_arg && argv[a+1][0] != '-') ? argv[++a] : "-";
+        } else if(value == "--camera-path" && has_arg){
+            camera_path = argv[++a];
+        } else if(value == "--turntable" && has_arg){
+            turntable_frames = atoi(argv[++a]);
+        } else if(value == "--fps" && has_arg){
+            animation.fps = std::max(1e-3, atof(argv[++a]));
+        } else if(value == "--interpolation" && has_arg){
+            std::string mode = argv[++a];
+            animation.interpolation = mode == "none" ? interpolate_none
+                                    : mode == "linear" ? interpolate_linear
+                                                       : interpolate_spline;
+        } else if(value == "--raw-stdout"){
+            animation.raw_stdout = true;
+        } else if(value == "--coordinator" && has_arg){
+            coordinator_port = atoi(argv[++a]);
+        } else if(value == "--worker" && has_arg){
+            worker_address = argv[++a];
+        } else if(value == "--tile" && has_arg){
+            distributed.tile_size = std::max(1, atoi(argv[++a]));
+        } else if(value == "--tile-spp" && has_arg){
+            distributed.tile_passes = std::max(1, atoi(argv[++a]));
+        } else if(value == "--compile-scene" && has_arg){
+            compile_file = argv[++a];
+        } else if(value == "--texture-cache-mb" && has_arg){
+            texture_cache_mb = atof(argv[++a]);
+        } else if(value == "--bvh" && has_arg){
+            bvh_name = argv[++a];
+        } else if(value == "--trace" && has_arg){
+            trace_file = argv[++a];
+        } else if(value == "--bvh-report" && has_arg){
+            bvh_report_file = argv[++a];
+        } else if(value == "--out-of-core" && has_arg){
+            out_of_core_mb = atof(argv[++a]);
+        } else if(value == "--page-dir" && has_arg){
+            page_directory = argv[++a];
+        } else if(value == "--band" && has_arg){
+            band_rows = std::max(1, atoi(argv[++a]));
+        } else if(value == "--heatmap" && has_arg){
+            heatmap_list = argv[++a];
+        } else if(value == "--scaling"){
+            scaling = true;
+            if(has_arg && argv[a+1][0] != '-')
+                scaling_study.threads = parse_thread_counts(argv[++a]);
+        } else if(value == "--pin" && has_arg){
+            std::stringstream list(argv[++a]);
+            std::string pinning;
+            while(std::getline(list, pinning, ','))
+                scaling_study.pinning.push_back(pinning);
+        } else if(value == "--schedule" && has_arg){
+            scaling_study.schedule = argv[++a];
+        } else if(value == "--format" && has_arg){
+            format_list = argv[++a];
+        } else if(value == "--texture-filter" && has_arg){
+            texture_filter_name = argv[++a];
+        } else if(value == "--bake-noise" && has_arg){
+            bake_noise = std::max(0, atoi(argv[++a]));
+        } else if(value == "--lazy-textures"){
+            lazy_textures = true;
+        } else if(value == "--check-obj" && has_arg){
+            check_obj_file = argv[++a];
+        } else if(value == "--merge"){
+            // --merge out.ckpt in1.ckpt in2.ckpt ...
+            while(a + 1 < argc && argv[a+1][0] != '-')
+                merge_files.push_back(argv[++a]);
+        } else {
+            std::cerr << "unknown option " << value << std::endl;
         }
     }
 
-    if(PREVIEW){
-        if(SDL_Init(SDL_INIT_VIDEO) < 0)
-        {
-            std::cout << "Failed to initialize the SDL2 library\n";
+    // with a budget or a target, the sample count is only an upper bound
+    if((time_budget > 0 || noise_target > 0) && !spp_given)
+        samples_per_pixel = INT_MAX;
+    int image_height = static_cast<int>(image_width / aspect_ratio);
+    trace_session trace(trace_file);
+
+    if(!format_list.empty()){
+        output_formats() = parse_formats(format_list);
+        if(output_formats() == 0)
+            return -1;
+    }
+
+    texture_cache::instance().set_capacity(size_t(texture_cache_mb * 1e6));
+    texture_cache::instance().set_lazy(lazy_textures);
+    texture_filtering() = texture_filter_name == "nearest" ? filter_nearest
+                        : texture_filter_name == "bilinear" ? filter_bilinear
+                                                            : filter_trilinear;
+    noise_bake_resolution() = bake_noise;
+    out_of_core().enabled = out_of_core_mb > 0;
+    out_of_core().cache_bytes = size_t(out_of_core_mb * 1e6);
+    out_of_core().directory = page_directory;
+    page_cache::instance().set_capacity(out_of_core().cache_bytes);
+    scene_bvh_layout() = bvh_name == "8" ? bvh_quantized8 : bvh_name == "16" ? bvh_quantized16 : bvh_pointers;
+
+    if(!check_obj_file.empty())
+        return compare_obj_loaders(check_obj_file.c_str()) ? 0 : -1;
+
+    if(!merge_files.empty()){
+        if(merge_files.size() < 2){
+            std::cerr << "usage : --merge out.ckpt in.ckpt ..." << std::endl;
             return -1;
         }
+        framebuffer merged;
+        if(!load_checkpoint(merge_files[1], merged, sampler))
+            return -1;
+        for(size_t f = 2; f < merge_files.size(); ++f){
+            framebuffer other;
+            sampler_state other_sampler;
+            if(!load_checkpoint(merge_files[f], other, other_sampler)
+                || !merge_checkpoint(merged, sampler, other, other_sampler))
+                return -1;
+        }
+        if(!save_checkpoint(merge_files[0], merged, sampler))
+            return -1;
+        std::cerr << merge_files.size() - 1 << " checkpoints merged, " << merged.min_samples() << " samples per pixel" << std::endl;
+        write_image(merged);
+        return 0;
     }
 
-    std::cerr << "attention y et z inversé par rapport à blender" << std::endl;
-    // Image
-    double aspect_ratio = 4.0 / 3.0;
-    int image_width = 800;
-    int image_height = static_cast<int>(image_width / aspect_ratio);
-    int samples_per_pixel = 1000;
-    int max_depth = 50;
+    if(!server_path.empty())
+        return run_server(server_path);
 
-    // World
-    color background(0,0,0);
-    hittable_list mesh;
-    hittable_list world;
-    std::vector<shared_ptr <hittable> > light;
-    camera cam;
-
-    // open_test(mesh, cam, aspect_ratio);
-    // open_cornell(mesh, cam, aspect_ratio);
-    open_cornell_empty(mesh, cam, aspect_ratio);
-    // open_sportCar(mesh, cam, aspect_ratio);
-    // open_sponza(mesh, cam, aspect_ratio);
-    // open_spaceship(mesh, cam, aspect_ratio);
-    // open_bigguy(mesh, cam, aspect_ratio);
-    // final_scene(mesh, cam, image_width, aspect_ratio);
-
-    // create BVH
-    // world.add(make_shared<bvh_node>(mesh, 0, 1));
-    world = mesh;
-    std::cerr << std::endl;
+    if(animation.raw_stdout)
+        redirect_stdout(animation);
 
-    // world.add(make_shared<sphere>(point3(0,3.5,0),1,make_shared<dielectric>(1.5)));
-    // world.add(make_shared<sphere>(point3(-3,3.5,-1.5),1,make_shared<metal>(color(0.8,0.8,0.8),1)));
-    
-    auto matmetal = make_shared<metal>(color(0.8,0.6,0.2),0.1);
-    auto dielec = make_shared<dielectric>(1.5);
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("../data/earthmap.jpg"));
-    world.add(make_shared<sphere>(point3(0.5,0.5,-0.1),0.4,matmetal));
-    world.add(make_shared<sphere>(point3(-0.5,0.5,-0.2),0.4,dielec));
-    world.add(make_shared<sphere>(point3(-0.5,0.5,-0.2),0.3,emat));
-
-    // add light 
-    for (int i = 0; i < mesh.objects.size(); ++i){
-        if(mesh.objects[i]->have_material_light()){
-            light.push_back(mesh.objects[i]);
-            world.add(mesh.objects[i]);
+    if(!worker_address.empty()){
+        // --worker host:port
+        size_t colon = worker_address.rfind(':');
+        if(colon == std::string::npos){
+            std::cerr << "usage : --worker host:port" << std::endl;
+            return -1;
         }
+        return run_worker(worker_address.substr(0, colon), atoi(worker_address.c_str() + colon + 1));
     }
-    std::cerr << "light : " << light.size() << std::endl;
-
-    if(PREVIEW){
-        window = SDL_CreateWindow("render",
-                                            SDL_WINDOWPOS_CENTERED,
-                                            SDL_WINDOWPOS_CENTERED,
-                                            image_width, image_height,
-                                            0);
-
-        if(!window)
-        {
-            std::cout << "Failed to create window\n";
+
+    if(coordinator_port > 0){
+        if(!scene_exists(scene_name) || scene_name.size() >= sizeof(job_description::scene)){
+            std::cerr << "[error] unknown scene " << scene_name << std::endl;
             return -1;
         }
+        if(samples_per_pixel == INT_MAX)
+            samples_per_pixel = 1000;
+        // without a tile the coordinator would wait for one forever
+        if(samples_per_pixel <= 0){
+            std::cerr << "[error] the coordinator needs --spp above 0" << std::endl;
+            return -1;
+        }
+        job_description job;
+        memset(&job, 0, sizeof(job));
+        strncpy(job.scene, scene_name.c_str(), sizeof(job.scene) - 1);
+        job.width = image_width;
+        job.height = image_height;
+        job.max_depth = max_depth;
+        job.seed = sampler.seed;
+
+        distributed.port = coordinator_port;
+        coordinator coord(job, samples_per_pixel, distributed);
+        if(!coord.run())
+            return -1;
+        write_image(coord.fb);
+        std::cerr << "Done\n";
+        return 0;
+    }
+
+    // no framebuffer of the whole image for a large frame
+    if(band_rows > 0){
+        scene sc;
+        if(!load_scene(scene_name, sc, aspect_ratio, image_width))
+            return -1;
+        large_frame_settings large;
+        large.image_width = image_width;
+        large.image_height = image_height;
+        large.samples_per_pixel = samples_per_pixel == INT_MAX ? 1000 : samples_per_pixel;
+        large.max_depth = max_depth;
+        large.seed = sampler.seed;
+        large.band_rows = band_rows;
+        int status = render_large_frame(sc, large);
+        page_cache::instance().report();
+        if(write_render_stats("stats.json"))
+            std::cerr << "render statistics generated" << std::endl;
+        return status;
+    }
+
+    // Render
+    framebuffer fb(image_width, image_height);
+    sampler.max_depth = max_depth;
+    sampler.scene = scene_name;
+    if(!resume_file.empty()){
+        if(!load_checkpoint(resume_file, fb, sampler)
+            || !same_render(sampler, scene_name, max_depth, resume_file))
+            return -1;
+        image_width = fb.width;
+        image_height = fb.height;
+        if(checkpoint_file.empty())
+            checkpoint_file = resume_file;
+        std::cerr << "resume " << resume_file << " at " << fb.min_samples() << " samples per pixel" << std::endl;
+    }
 
-        window_surface = SDL_GetWindowSurface(window);
+    std::cerr << "attention y et z inversé par rapport à blender" << std::endl;
 
-        if(!window_surface)
-        {
-            std::cout << "Failed to get the surface from the window\n";
+    // World
+    scene sc;
+    if(!load_scene(scene_name, sc, aspect_ratio, image_width))
+        return -1;
+    color& background = sc.background;
+    hittable_list& world = sc.world;
+    camera& cam = sc.cam;
+
+    if(!compile_file.empty())
+        return write_scene_file(compile_file, world, sc.lights, cam, background) ? 0 : -1;
+
+    if(!camera_path.empty() || turntable_frames > 0){
+        std::vector<camera_key> keys;
+        if(turntable_frames > 0){
+            keys = turntable(cam, turntable_frames);
+            animation.interpolation = interpolate_none;
+        } else if(!read_camera_path(camera_path.c_str(), cam, keys)){
             return -1;
         }
+        animation.image_width = image_width;
+        animation.image_height = image_height;
+        animation.samples_per_pixel = samples_per_pixel == INT_MAX ? 16 : samples_per_pixel;
+        animation.max_depth = max_depth;
+        animation.seed = sampler.seed;
+        return render_animation(sc, sample_path(keys, animation), animation);
     }
 
-    // Render
-    std::vector<color> pixel_list;
-    pixel_list.resize(image_width*image_height);
-
-    for (int s = 0; s < samples_per_pixel; ++s) {
-        std::cerr << "\rScanlines remaining : " << int((float(s)/float(samples_per_pixel))*100) << " %" << std::flush;
-        #pragma omp parallel for schedule(dynamic, 16)
-        for (int j = image_height-1; j >= 0; --j) {
-            for (int i = 0; i < image_width; ++i) {
-                color pixel_color(0, 0, 0);
-                auto u = (i + random_double()) / (image_width-1);
-                auto v = (j + random_double()) / (image_height-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color = (indirect_ray_color(r, background, world, max_depth, s, samples_per_pixel)*1
-                            /*+ direct_ray_color(r, background, world, light, max_depth, s, samples_per_pixel)*0.5*/);
-                pixel_list[offset(i,j,image_height,image_width)] += pixel_color;
-
-                if(PREVIEW){
-                    // temporary render windows
-                    SDL_Rect rect;
-                    rect.x = i ;
-                    rect.y = image_height - j ;
-                    rect.h = rect.w = 1;
-
-                    double scale = 1.0 / s;
-                    Uint8 red,green,blue;
-                    red = static_cast<unsigned char>(256 * clamp(sqrt(scale * pixel_list[offset(i,j,image_height,image_width)].x), 0.0, 0.999));
-                    green = static_cast<unsigned char>(256 * clamp(sqrt(scale * pixel_list[offset(i,j,image_height,image_width)].y), 0.0, 0.999));
-                    blue = static_cast<unsigned char>(256 * clamp(sqrt(scale * pixel_list[offset(i,j,image_height,image_width)].z), 0.0, 0.999));
-
-                    Uint32 uintcolor = SDL_MapRGB(window_surface->format, red, green, blue);
-                    SDL_FillRect (window_surface, &rect, uintcolor);
-                }
-            }
+    if(!bvh_report_file.empty() && write_bvh_report(world, bvh_report_file.c_str()))
+        std::cerr << "bvh report generated" << std::endl;
+
+    if(!heatmap_list.empty()){
+        heatmap_settings heatmaps;
+        if(!parse_heatmaps(heatmap_list, heatmaps))
+            return -1;
+        render_heatmaps(cam, world, image_width, image_height, heatmaps);
+    }
+
+    if(scaling){
+        scaling_study.passes = spp_given ? samples_per_pixel : 4;
+        scaling_study.seed = sampler.seed;
+        return run_scaling(cam, world, background, image_width, image_height, max_depth, scaling_study);
+    }
+
+    if(INTERACTIVE)
+        return run_interactive(world, background, cam, image_width, image_height, max_depth);
+
+    // the preview runs on its own thread and only reads snapshots of fb
+    preview_window preview(image_width, image_height, preview_fps);
+    if(PREVIEW && !preview.start())
+        return -1;
+
+    progressive_control progress(time_budget, noise_target, snapshot_interval);
+    int samples_done = fb.min_samples();
+    double last_checkpoint = 0;
+    image_writer snapshots;
+
+    for (int s = samples_done; s < samples_per_pixel; ++s) {
+        if(time_budget > 0 || noise_target > 0)
+            std::cerr << "\rPass " << s << " : " << progress.elapsed() << " s, error " << (progress.passes.empty() ? infinity : progress.passes.back().error) << "    " << std::flush;
+        else
+            std::cerr << "\rScanlines remaining : " << int((float(s)/float(samples_per_pixel))*100) << " %" << std::flush;
+        render_pass(cam, world, background, fb, max_depth, sampler.seed, sampler.passes);
+        sampler.passes++;
+        samples_done = fb.min_samples();
+        progress.record(samples_done, estimate_relative_error(fb));
+        // encoded in the background, skipped if the previous snapshot is not written yet
+        if(progress.snapshot_due())
+            snapshots.submit(fb, "result");
+        if(!checkpoint_file.empty() && progress.elapsed() - last_checkpoint >= checkpoint_interval){
+            last_checkpoint = progress.elapsed();
+            sampler_state state = sampler;
+            state.seconds += last_checkpoint;
+            save_checkpoint(checkpoint_file, fb, state);
         }
         if(PREVIEW)
-            SDL_UpdateWindowSurface(window);
+            preview.publish(fb);
+        if(progress.should_stop() || preview.closed())
+            break;
     }
+    preview.stop();
 
     std::cerr << std::endl;
-    // write image in format png, bmp and hdr
-    write_image(pixel_list, image_width, image_height, samples_per_pixel);
+    std::cerr << samples_done << " samples per pixel in " << progress.elapsed() << " s" << std::endl;
+    page_cache::instance().report();
+    if(write_render_stats("stats.json"))
+        std::cerr << "render statistics generated" << std::endl;
+    if(!checkpoint_file.empty()){
+        sampler.seconds += progress.elapsed();
+        if(save_checkpoint(checkpoint_file, fb, sampler))
+            std::cerr << "checkpoint " << checkpoint_file << " saved" << std::endl;
+    }
+    // write image in the formats of --format, png, bmp and hdr by default
+    snapshots.wait();
+    write_image(fb);
+    // and the samples reached by each pass
+    if(progress.write_log("result.json"))
+        std::cerr << "pass log generated" << std::endl;
     std::cerr << "Done\n";
 }
\ No newline at end of file